@@ -0,0 +1,489 @@
+// Benchmarks of the decoding pipeline on generated clips. Run it from the
+// build directory:
+//     ./glitch_bench [--save baseline.json] [--baseline baseline.json]
+// With a baseline, any benchmark slower than the tolerance fails the run.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <sys/resource.h>
+
+#include "exporter.hpp"
+#include "frame_scorer.hpp"
+#include "glitch_effects.hpp"
+#include "synthetic_video.hpp"
+#include "video_decoder.hpp"
+#include "yuv_convert.hpp"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    fs::path work_dir = fs::temp_directory_path() / "glitch_bench";
+    std::string baseline_path;
+    std::string save_path;
+    double tolerance = 0.15; // allowed slowdown
+    int frames = 120;
+    int repeat = 3;
+    bool quick = false;
+};
+
+// Throughput of one benchmark, the best of all repeats.
+struct Result {
+    double fps = 0;
+    double ns_per_frame = 0;
+};
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void keep_best(Result& best, int frames, double seconds)
+{
+    if (frames <= 0 or seconds <= 0)
+        return;
+    double fps = frames / seconds;
+    if (fps > best.fps)
+        best = Result { fps, seconds * 1e9 / frames };
+}
+
+// Decode every frame. `read` is the decoding plus the conversion to BGR,
+// `to_bgr` is the conversion alone.
+static void bench_read(const std::string& path, int repeat, Result& read, Result& to_bgr)
+{
+    for (int r = 0; r < repeat; r++) {
+        VideoDecoder decoder { path, AV_HWDEVICE_TYPE_NONE };
+        if (!decoder.is_valid())
+            return;
+        int frames = 0;
+        double grab_seconds = 0, convert_seconds = 0;
+        while (true) {
+            auto start = Clock::now();
+            if (decoder.grab(false) != 0)
+                break;
+            auto grabbed = Clock::now();
+            if (decoder.retrieve() != 0)
+                break;
+            grab_seconds += std::chrono::duration<double>(grabbed - start).count();
+            convert_seconds += seconds_since(grabbed);
+            frames++;
+        }
+        keep_best(read, frames, grab_seconds + convert_seconds);
+        keep_best(to_bgr, frames, convert_seconds);
+    }
+}
+
+// Score the first decoded frames of the clip, without the decoding.
+static void bench_score(const std::string& path, int repeat, Result& score)
+{
+    std::vector<FramePtr> frames;
+    {
+        VideoDecoder decoder { path, AV_HWDEVICE_TYPE_NONE };
+        FramePtr frame;
+        while (decoder.is_valid() and frames.size() < 30 and decoder.read(frame) == 0)
+            frames.push_back(std::move(frame));
+    }
+    for (int r = 0; r < repeat; r++) {
+        FrameScorer scorer;
+        auto start = Clock::now();
+        for (size_t i = 0; i < frames.size(); i++)
+            scorer.score(frames[i].get(), (int)i + 1);
+        keep_best(score, (int)frames.size(), seconds_since(start));
+    }
+}
+
+// Corrupt the video packets of the clip, in memory. This is the work of
+// `VideoDecoder::random_touch` without the decoding around it.
+static void bench_touch(const std::string& path, int repeat, Result& touch)
+{
+    AVFormatContext* input = nullptr;
+    if (avformat_open_input(&input, path.c_str(), nullptr, nullptr) < 0)
+        return;
+    std::vector<AVPacket*> packets;
+    if (avformat_find_stream_info(input, nullptr) >= 0) {
+        int index = av_find_best_stream(input, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        AVPacket* packet = av_packet_alloc();
+        while (av_read_frame(input, packet) >= 0) {
+            if (packet->stream_index == index and av_packet_make_writable(packet) >= 0)
+                packets.push_back(av_packet_clone(packet));
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+    }
+    avformat_close_input(&input);
+
+    CorruptionEngine engine { CorruptionOptions { 42 } };
+    for (int r = 0; r < repeat; r++) {
+        auto start = Clock::now();
+        for (AVPacket* packet : packets)
+            engine.touch(packet);
+        keep_best(touch, (int)packets.size(), seconds_since(start));
+    }
+    for (AVPacket* packet : packets)
+        av_packet_free(&packet);
+}
+
+// The export loop of the command line tool, thumbnails of every 10th frame.
+static void bench_export(const std::string& path, const fs::path& export_dir, int frames, int repeat, Result& result)
+{
+    ExportSettings settings;
+    settings.export_dir = export_dir;
+    settings.hw_acc = AV_HWDEVICE_TYPE_NONE;
+    settings.geometry.width = 320;
+    settings.geometry.height = 320;
+    settings.geometry.crop = CropMode::Center;
+    settings.decoder.output = settings.geometry;
+    settings.decoder.quality = DecodeQuality::Preview;
+    settings.decoder.corruption.seed = 42;
+    settings.selection.every = 10;
+    for (int r = 0; r < repeat; r++) {
+        fs::remove_all(export_dir);
+        fs::create_directories(export_dir);
+        auto start = Clock::now();
+        if (export_range(path, settings) < 0)
+            return;
+        keep_best(result, frames, seconds_since(start));
+    }
+}
+
+// Frames `glitch` streams to stdout as Y4M for the given arguments, -1 if it
+// cannot be run.
+static int count_stream_frames(const fs::path& glitch, const std::string& arguments)
+{
+    std::string command = "'" + glitch.string() + "' " + arguments + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        return -1;
+
+    // The header gives the size of every frame.
+    std::string header;
+    for (int c; (c = std::fgetc(pipe)) != EOF and c != '\n';)
+        header.push_back((char)c);
+    std::smatch match;
+    int frames = -1;
+    if (std::regex_search(header, match, std::regex { "^YUV4MPEG2 W(\\d+) H(\\d+)" })) {
+        size_t size = (size_t)std::stoi(match[1]) * std::stoi(match[2]) * 3 / 2;
+        std::vector<char> data(size);
+        char marker[6];
+        frames = 0;
+        while (std::fread(marker, 1, 6, pipe) == 6 and std::memcmp(marker, "FRAME\n", 6) == 0
+            and std::fread(data.data(), 1, size, pipe) == size)
+            frames++;
+    }
+    return pclose(pipe) == 0 ? frames : -1;
+}
+
+// A stream run writes every frame of the clip, not only the frames an image
+// export would pick, with or without scoring options. Skipped without a
+// `glitch` next to the bench.
+static int verify_stream(const fs::path& glitch, const std::string& path, int frames)
+{
+    if (!fs::exists(glitch))
+        return 0;
+    int mismatches = 0;
+    for (std::string options : { "", "--top 1 " }) {
+        int streamed = count_stream_frames(glitch, options + "'" + path + "' - no-touching");
+        if (streamed != frames) {
+            std::cerr << "Streamed " << streamed << " of " << frames << " frames with '" << options << "': " << path << std::endl;
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Random planes of a layout, with odd sizes to cover the row tails.
+struct YuvPlanes {
+    std::vector<uint8_t> planes[3];
+    YuvImage image;
+
+    YuvPlanes(YuvLayout layout, int width, int height, bool full_range)
+    {
+        int bytes = layout == YuvLayout::Yuv420p10 ? 2 : 1;
+        int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+        int linesize[3] = { width * bytes, chroma_width * bytes, chroma_width * bytes };
+        if (layout == YuvLayout::Nv12)
+            linesize[1] = chroma_width * 2;
+        std::mt19937 random { 42 };
+        for (int i = 0; i < 3; i++) {
+            planes[i].resize((size_t)linesize[i] * (i ? chroma_height : height));
+            for (size_t j = 0; j < planes[i].size(); j++)
+                planes[i][j] = bytes == 2 and j % 2 ? random() & 3 : random() & 255;
+        }
+        image = YuvImage { { planes[0].data(), planes[1].data(), planes[2].data() },
+            { linesize[0], linesize[1], linesize[2] }, layout, width, height, full_range };
+    }
+};
+
+// Every kernel this CPU supports must match the scalar reference byte for byte.
+static int verify_yuv_kernels()
+{
+    int mismatches = 0;
+    for (int layout = 0; layout < (int)YuvLayout::Count; layout++) {
+        for (int output = 0; output < (int)BgrLayout::Count; output++) {
+            for (bool full_range : { false, true }) {
+                YuvPlanes planes { (YuvLayout)layout, 1923, 35, full_range };
+                int step = planes.image.width * (output == (int)BgrLayout::Bgra ? 4 : 3);
+                std::vector<uint8_t> reference((size_t)step * planes.image.height), result(reference.size());
+                yuv_to_bgr(planes.image, reference.data(), step, (BgrLayout)output, 1, SimdLevel::Scalar);
+                for (int level = 1; level <= (int)simd_level(); level++) {
+                    std::fill(result.begin(), result.end(), 0);
+                    yuv_to_bgr(planes.image, result.data(), step, (BgrLayout)output, 3, (SimdLevel)level);
+                    if (result != reference) {
+                        std::cerr << "Mismatch: " << simd_name((SimdLevel)level) << " layout " << layout
+                                  << " output " << output << " full range " << full_range << std::endl;
+                        mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Conversion of a 1080p frame with every kernel this CPU supports.
+static void bench_yuv_kernels(int repeat, std::map<std::string, Result>& results)
+{
+    const char* layout_names[] = { "yuv420p", "nv12", "yuv420p10" };
+    for (int layout = 0; layout < (int)YuvLayout::Count; layout++) {
+        YuvPlanes planes { (YuvLayout)layout, 1920, 1080, false };
+        std::vector<uint8_t> bgr((size_t)1920 * 3 * 1080);
+        for (int level = 0; level <= (int)simd_level(); level++) {
+            Result& result = results[std::string(layout_names[layout]) + "_1920x1080/yuv_to_bgr_" + simd_name((SimdLevel)level)];
+            for (int r = 0; r < repeat; r++) {
+                auto start = Clock::now();
+                for (int i = 0; i < 10; i++)
+                    yuv_to_bgr(planes.image, bgr.data(), 1920 * 3, BgrLayout::Bgr24, 1, (SimdLevel)level);
+                keep_best(result, 10, seconds_since(start));
+            }
+        }
+    }
+}
+
+// Gradients with a little noise, so there are bright runs to sort.
+static cv::Mat effects_image(int width, int height)
+{
+    cv::Mat image { height, width, CV_8UC3 };
+    std::mt19937 random { 42 };
+    for (int y = 0; y < height; y++) {
+        uint8_t* row = image.ptr(y);
+        for (int x = 0; x < width * 3; x++)
+            row[x] = (uint8_t)((x / 3 * 255 / width + y * 255 / height) / 2 + (x % 3) * 40 + (random() & 15));
+    }
+    return image;
+}
+
+static std::vector<Effect> every_effect()
+{
+    std::vector<Effect> effects;
+    for (EffectType type : { EffectType::ChannelShift, EffectType::RowShift, EffectType::BlockShift,
+             EffectType::ScanlineTear, EffectType::PixelSort, EffectType::Quantize })
+        effects.push_back(default_effect(type));
+    return effects;
+}
+
+// The vector effect kernels must match the scalar ones byte for byte.
+static int verify_effect_kernels()
+{
+    int mismatches = 0;
+    cv::Mat source = effects_image(1923, 67);
+    EffectChain reference { every_effect(), 42, SimdLevel::Scalar }, chain { every_effect(), 42 };
+    for (uint64_t key = 0; key < 16; key++) {
+        cv::Mat expected = source.clone(), result = source.clone();
+        reference.apply(expected, key);
+        chain.apply(result, key);
+        for (int y = 0; y < source.rows; y++) {
+            if (std::memcmp(expected.ptr(y), result.ptr(y), (size_t)source.cols * 3) != 0) {
+                std::cerr << "Mismatch: effects key " << key << " row " << y << std::endl;
+                mismatches++;
+                break;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// The whole effect chain on a 1080p frame.
+static void bench_effects(int repeat, std::map<std::string, Result>& results)
+{
+    cv::Mat source = effects_image(1920, 1080), image;
+    for (SimdLevel level : { SimdLevel::Scalar, simd_level() }) {
+        EffectChain chain { every_effect(), 42, level };
+        Result& result = results[std::string("effects_1920x1080/chain_") + simd_name(level)];
+        for (int r = 0; r < repeat; r++) {
+            double seconds = 0;
+            for (int i = 0; i < 10; i++) {
+                source.copyTo(image);
+                auto start = Clock::now();
+                chain.apply(image, i);
+                seconds += seconds_since(start);
+            }
+            keep_best(result, 10, seconds);
+        }
+    }
+}
+
+// Read `"name": {"fps": 123.4` entries of a results file written by this tool.
+static std::map<std::string, double> load_baseline(const std::string& path)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream file { path };
+    std::stringstream text;
+    text << file.rdbuf();
+    std::string content = text.str();
+    std::regex entry { R"re("([^"]+)": \{"fps": ([0-9.eE+-]+))re" };
+    for (auto it = std::sregex_iterator(content.begin(), content.end(), entry); it != std::sregex_iterator(); ++it)
+        baseline[(*it)[1]] = std::stod((*it)[2]);
+    return baseline;
+}
+
+static std::string to_json(const std::map<std::string, Result>& results)
+{
+    std::ostringstream out;
+    out << "{\n  \"peak_rss_kb\": " << peak_rss_kb() << ",\n  \"results\": {";
+    bool first = true;
+    for (auto& [name, result] : results) {
+        out << (first ? "" : ",") << "\n    \"" << name << "\": {\"fps\": " << result.fps << ", \"ns_per_frame\": " << (int64_t)result.ns_per_frame << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg { argv[i] };
+        bool has_value = i + 1 < argc;
+        if (arg == "--baseline" and has_value) {
+            options.baseline_path = argv[++i];
+        } else if (arg == "--save" and has_value) {
+            options.save_path = argv[++i];
+        } else if (arg == "--tolerance" and has_value) {
+            options.tolerance = std::stod(argv[++i]);
+        } else if (arg == "--frames" and has_value) {
+            options.frames = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--repeat" and has_value) {
+            options.repeat = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--work-dir" and has_value) {
+            options.work_dir = argv[++i];
+        } else if (arg == "--quick") {
+            options.quick = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!parse_args(argc, argv, options)) {
+        std::cout << "Usage:\n    " << argv[0] << " [options]\n"
+                  << "Options:\n"
+                  << "    --baseline <file>   compare with the results of an earlier run, fail on regressions\n"
+                  << "    --save <file>       write the results, to be used as a baseline later\n"
+                  << "    --tolerance <t>     allowed slowdown against the baseline, 0.15 by default\n"
+                  << "    --frames <n>        frames of every generated clip, 120 by default\n"
+                  << "    --repeat <n>        runs of every benchmark, the best one counts, 3 by default\n"
+                  << "    --work-dir <dir>    where the clips and images go, a temp dir by default\n"
+                  << "    --quick             only the smallest resolution"
+                  << std::endl;
+        return 1;
+    }
+    av_log_set_level(AV_LOG_ERROR);
+    fs::create_directories(options.work_dir);
+
+    std::vector<SyntheticClip> clips;
+    std::vector<std::pair<int, int>> sizes { { 320, 240 }, { 1280, 720 }, { 1920, 1080 } };
+    if (options.quick)
+        sizes.resize(1);
+    for (AVCodecID codec : { AV_CODEC_ID_H264, AV_CODEC_ID_MPEG4, AV_CODEC_ID_MJPEG })
+        for (auto [width, height] : sizes)
+            clips.push_back(SyntheticClip { codec, width, height, options.frames });
+
+    std::map<std::string, Result> results;
+    int mismatches = verify_yuv_kernels();
+    std::cout << "YUV kernels up to " << simd_name(simd_level()) << ": "
+              << (mismatches ? "MISMATCH" : "bit exact") << std::endl;
+    bench_yuv_kernels(options.repeat, results);
+    int effect_mismatches = verify_effect_kernels();
+    std::cout << "Effect kernels up to " << simd_name(simd_level()) << ": "
+              << (effect_mismatches ? "MISMATCH" : "bit exact") << std::endl;
+    mismatches += effect_mismatches;
+    bench_effects(options.repeat, results);
+    for (auto& [name, result] : results)
+        std::cout << name << ": " << result.fps << " frames/s, " << (int64_t)result.ns_per_frame << " ns/frame" << std::endl;
+    fs::path glitch = fs::absolute(argv[0]).parent_path() / "glitch";
+    bool stream_verified = false;
+    for (const SyntheticClip& clip : clips) {
+        // Clips are kept between runs, the content never changes.
+        std::string path = (options.work_dir / (clip.name() + "-" + std::to_string(clip.frames) + ".mkv")).string();
+        if (!fs::exists(path) and write_synthetic_clip(clip, path) < 0) {
+            fs::remove(path);
+            continue;
+        }
+        if (!stream_verified) {
+            int stream_mismatches = verify_stream(glitch, path, clip.frames);
+            std::cout << "Stream of " << clip.name() << ": " << (stream_mismatches ? "MISMATCH" : "every frame") << std::endl;
+            mismatches += stream_mismatches;
+            stream_verified = true;
+        }
+
+        bench_read(path, options.repeat, results[clip.name() + "/read"], results[clip.name() + "/to_bgr"]);
+        bench_touch(path, options.repeat, results[clip.name() + "/random_touch"]);
+        bench_score(path, options.repeat, results[clip.name() + "/score"]);
+        bench_export(path, options.work_dir / "images", clip.frames, options.repeat, results[clip.name() + "/export"]);
+        for (auto& suffix : { "/read", "/to_bgr", "/random_touch", "/score", "/export" }) {
+            const Result& result = results[clip.name() + suffix];
+            std::cout << clip.name() << suffix << ": " << result.fps << " frames/s, "
+                      << (int64_t)result.ns_per_frame << " ns/frame" << std::endl;
+        }
+    }
+    std::cout << "Peak RSS: " << peak_rss_kb() / 1024 << " MB" << std::endl;
+
+    if (!options.save_path.empty()) {
+        std::ofstream file { options.save_path };
+        file << to_json(results);
+    }
+
+    // Compare with the baseline. Benchmarks missing on either side are
+    // skipped, e.g. an encoder not in this FFmpeg build.
+    int regressions = 0;
+    if (!options.baseline_path.empty()) {
+        std::map<std::string, double> baseline = load_baseline(options.baseline_path);
+        if (baseline.empty()) {
+            std::cerr << "Cannot read the baseline: " << options.baseline_path << std::endl;
+            return 1;
+        }
+        for (auto& [name, result] : results) {
+            auto it = baseline.find(name);
+            if (it == baseline.end() or result.fps <= 0)
+                continue;
+            if (result.fps < it->second * (1.0 - options.tolerance)) {
+                std::cerr << "Regression: " << name << " " << result.fps << " frames/s, was " << it->second << std::endl;
+                regressions++;
+            }
+        }
+        std::cout << regressions << " regressions against " << options.baseline_path << std::endl;
+    }
+    if (mismatches)
+        return 3;
+    return regressions == 0 ? 0 : 2;
+}
@@ -0,0 +1,143 @@
+#include "synthetic_video.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavutil/frame.h"
+}
+
+std::string SyntheticClip::name() const
+{
+    std::string codec_name = codec == AV_CODEC_ID_H264 ? "h264" : codec == AV_CODEC_ID_MPEG4 ? "mpeg4" : codec == AV_CODEC_ID_MJPEG ? "mjpeg" : avcodec_get_name(codec);
+    return codec_name + "_" + std::to_string(width) + "x" + std::to_string(height);
+}
+
+// Gradients sliding in opposite directions, with a noisy block bouncing
+// around, so that there is both motion and texture for the encoder.
+static void draw(AVFrame* frame, int index)
+{
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (index + 1);
+    auto next = [&state]() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+
+    int block = frame->height / 4;
+    int block_x = (index * 7) % std::max(1, frame->width - block);
+    int block_y = (index * 3) % std::max(1, frame->height - block);
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t* row = frame->data[0] + (size_t)y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++)
+            row[x] = (uint8_t)(x + y + index * 2);
+        if (y >= block_y and y < block_y + block) {
+            for (int x = block_x; x < block_x + block; x += 8) {
+                uint64_t r = next();
+                for (int i = 0; i < 8 and x + i < block_x + block; i++)
+                    row[x + i] = (uint8_t)(r >> (i * 8));
+            }
+        }
+    }
+    for (int y = 0; y < frame->height / 2; y++) {
+        uint8_t* u = frame->data[1] + (size_t)y * frame->linesize[1];
+        uint8_t* v = frame->data[2] + (size_t)y * frame->linesize[2];
+        for (int x = 0; x < frame->width / 2; x++) {
+            u[x] = (uint8_t)(128 + x - index);
+            v[x] = (uint8_t)(64 + y + index);
+        }
+    }
+}
+
+// Move the encoded packets into the file.
+static int drain(AVCodecContext* ctx, AVFormatContext* output, AVStream* stream, AVPacket* packet)
+{
+    int ret = 0;
+    while ((ret = avcodec_receive_packet(ctx, packet)) == 0) {
+        av_packet_rescale_ts(packet, ctx->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        ret = av_interleaved_write_frame(output, packet);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) or ret == AVERROR_EOF ? 0 : ret;
+}
+
+int write_synthetic_clip(const SyntheticClip& clip, const std::string& path)
+{
+    const AVCodec* encoder = avcodec_find_encoder(clip.codec);
+    if (!encoder) {
+        std::cerr << "No encoder for " << clip.name() << ", skipped." << std::endl;
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    AVFormatContext* output = nullptr;
+    if (avformat_alloc_output_context2(&output, nullptr, nullptr, path.c_str()) < 0) {
+        std::cerr << "Cannot create output context: " << path << std::endl;
+        return -1;
+    }
+
+    AVCodecContext* ctx = avcodec_alloc_context3(encoder);
+    ctx->width = clip.width;
+    ctx->height = clip.height;
+    ctx->time_base = AVRational { 1, 30 };
+    ctx->framerate = AVRational { 30, 1 };
+    ctx->pix_fmt = clip.codec == AV_CODEC_ID_MJPEG ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    ctx->gop_size = 30;
+    ctx->max_b_frames = clip.codec == AV_CODEC_ID_MJPEG ? 0 : 2;
+    ctx->bit_rate = (int64_t)clip.width * clip.height * 3;
+    ctx->thread_count = 1; // multi threaded encoders are not deterministic
+    if (output->oformat->flags & AVFMT_GLOBALHEADER)
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    AVStream* stream = avformat_new_stream(output, nullptr);
+    AVFrame* frame = av_frame_alloc();
+    AVPacket* packet = av_packet_alloc();
+    int ret = avcodec_open2(ctx, encoder, nullptr);
+    if (ret < 0)
+        std::cerr << "Cannot open the encoder for " << clip.name() << std::endl;
+    if (ret >= 0)
+        ret = avcodec_parameters_from_context(stream->codecpar, ctx);
+    stream->time_base = ctx->time_base;
+    if (ret >= 0 and !(output->oformat->flags & AVFMT_NOFILE))
+        ret = avio_open(&output->pb, path.c_str(), AVIO_FLAG_WRITE);
+    if (ret >= 0)
+        ret = avformat_write_header(output, nullptr);
+
+    // Encode the frames.
+    frame->format = ctx->pix_fmt;
+    frame->width = clip.width;
+    frame->height = clip.height;
+    if (ret >= 0)
+        ret = av_frame_get_buffer(frame, 0);
+    for (int i = 0; ret >= 0 and i < clip.frames; i++) {
+        ret = av_frame_make_writable(frame);
+        if (ret < 0)
+            break;
+        draw(frame, i);
+        frame->pts = i;
+        ret = avcodec_send_frame(ctx, frame);
+        if (ret >= 0)
+            ret = drain(ctx, output, stream, packet);
+    }
+
+    // Flush the encoder.
+    if (ret >= 0)
+        ret = avcodec_send_frame(ctx, nullptr);
+    if (ret >= 0)
+        ret = drain(ctx, output, stream, packet);
+    if (ret >= 0)
+        ret = av_write_trailer(output);
+    if (ret < 0)
+        std::cerr << "Error writing " << path << ": " << ret << std::endl;
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    if (output->pb and !(output->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&output->pb);
+    avformat_free_context(output);
+    return ret < 0 ? ret : 0;
+}
@@ -0,0 +1,29 @@
+#if !defined(SYNTHETIC_VIDEO_HPP)
+#define SYNTHETIC_VIDEO_HPP
+
+#include <string>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+/// @brief A generated test clip.
+struct SyntheticClip {
+    AVCodecID codec;
+    int width;
+    int height;
+    int frames;
+
+    /// @brief Get a short name like `h264_1280x720`, used as the file stem
+    /// and the key of the results.
+    std::string name() const;
+};
+
+/// @brief Encode a clip of moving gradients and noise. The content only
+/// depends on the clip settings, and the encoder runs on a single thread, so
+/// the same FFmpeg build always writes the same file.
+/// @param clip what to encode.
+/// @param path the output file, the container is guessed from the extension.
+/// @return 0 if success, negative for errors or a missing encoder.
+int write_synthetic_clip(const SyntheticClip& clip, const std::string& path);
+#endif // SYNTHETIC_VIDEO_HPP
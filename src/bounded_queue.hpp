@@ -0,0 +1,88 @@
+#if !defined(BOUNDED_QUEUE_HPP)
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/// @brief A bounded single-producer single-consumer queue linking two
+/// pipeline stages. It is lock free; a full queue makes the producer wait,
+/// which is the backpressure that keeps fast stages from running ahead.
+template <typename T>
+class BoundedQueue {
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // Producer and consumer positions live on their own cache lines.
+    alignas(64) std::atomic<size_t> head { 0 }; // next slot to pop
+    alignas(64) std::atomic<size_t> tail { 0 }; // next slot to push
+    alignas(64) std::atomic<bool> closed { false };
+
+    // Spin briefly, then yield, then sleep so an idle stage costs nothing.
+    static void backoff(int& spins)
+    {
+        spins++;
+        if (spins < 64)
+            return;
+        if (spins < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+public:
+    /// @brief Create a queue.
+    /// @param capacity the max number of items in flight, rounded up to a power of 2.
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    /// @brief Push an item, waiting while the queue is full.
+    /// @return false if the queue was closed and the item was dropped.
+    bool push(T&& item)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        int spins = 0;
+        while (pos - head.load(std::memory_order_acquire) > mask) {
+            if (closed.load(std::memory_order_acquire))
+                return false;
+            backoff(spins);
+        }
+        if (closed.load(std::memory_order_acquire))
+            return false;
+        slots[pos & mask] = std::move(item);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Pop an item, waiting while the queue is empty.
+    /// @return false once the queue is closed and drained.
+    bool pop(T& item)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        int spins = 0;
+        while (pos == tail.load(std::memory_order_acquire)) {
+            if (closed.load(std::memory_order_acquire) and pos == tail.load(std::memory_order_acquire))
+                return false;
+            backoff(spins);
+        }
+        item = std::move(slots[pos & mask]);
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Mark the end of the stream. Items already queued can still be popped.
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+};
+#endif // BOUNDED_QUEUE_HPP
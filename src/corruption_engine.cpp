@@ -0,0 +1,135 @@
+#include "corruption_engine.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// SplitMix64 finalizer. Hashing seed + counter gives independent numbers for
+// every counter value, and the loops using it have no serial dependency.
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static const uint64_t golden_gamma = 0x9e3779b97f4a7c15ULL;
+
+CorruptionEngine::CorruptionEngine(CorruptionOptions options)
+    : options(options)
+{
+}
+
+const CorruptionOptions& CorruptionEngine::get_options()
+{
+    return options;
+}
+
+void CorruptionEngine::set_intensity(double intensity)
+{
+    this->intensity = std::clamp(intensity, 0.0, 1.0);
+}
+
+int64_t CorruptionEngine::touch(AVPacket* packet, CorruptionRecord* record)
+{
+    if (record) {
+        record->stream_index = packet->stream_index;
+        record->pts = packet->pts;
+        record->dts = packet->dts;
+        record->pos = packet->pos;
+        record->spans.clear();
+    }
+
+    // Too small to be touched, and the data may be shared with the demuxer.
+    if (packet->size < 2 or av_packet_make_writable(packet) < 0)
+        return 0;
+
+    // The packet is identified by its place in the stream.
+    uint64_t key;
+    if (packet->pts != AV_NOPTS_VALUE)
+        key = (uint64_t)packet->pts;
+    else if (packet->dts != AV_NOPTS_VALUE)
+        key = (uint64_t)packet->dts;
+    else if (packet->pos >= 0)
+        key = (uint64_t)packet->pos;
+    else
+        key = counter++;
+    key = mix(key ^ ((uint64_t)packet->stream_index << 56));
+    return touch(packet->data, packet->size, key, record ? &record->spans : nullptr);
+}
+
+int64_t CorruptionEngine::replay(AVPacket* packet, const std::vector<CorruptionSpan>& spans)
+{
+    if (packet->size < 2 or av_packet_make_writable(packet) < 0)
+        return 0;
+    int64_t touched = 0;
+    for (auto&& span : spans) {
+        if (span.offset < 0 or span.length <= 0 or span.offset >= packet->size)
+            continue;
+        int length = std::min(span.length, packet->size - span.offset);
+        fill(packet->data + span.offset, length, span.key);
+        touched += length;
+    }
+    return touched;
+}
+
+int64_t CorruptionEngine::touch(uint8_t* data, int size, uint64_t key, std::vector<CorruptionSpan>* spans)
+{
+    if (size < 2)
+        return 0;
+
+    // A short sequence for the decisions, the bulk bytes come from fill().
+    uint64_t state = mix(options.seed ^ mix(key));
+    auto next = [&state]() { return mix(state += golden_gamma); };
+    auto uniform = [&next](int low, int high) {
+        if (high <= low)
+            return low;
+        return low + (int)(next() % (uint64_t)(high - low + 1));
+    };
+
+    // Should this packet be touched?
+    double odd = (next() >> 11) * 0x1.0p-53;
+    if (odd >= options.probability * intensity)
+        return 0;
+
+    int max_length = options.max_length > 0 ? std::min(options.max_length, size - 1) : size - 1;
+    int min_length = std::clamp(options.min_length, 1, max_length);
+    int64_t touched = 0;
+    for (int i = 0, count = uniform(options.min_spans, options.max_spans); i < count; i++) {
+        int start = uniform(0, size - 1);
+        int length = std::min(uniform(min_length, max_length), size - start);
+        uint64_t span_key = next();
+        fill(data + start, length, span_key);
+        if (spans)
+            spans->push_back({ start, length, span_key });
+        touched += length;
+    }
+    return touched;
+}
+
+void CorruptionEngine::fill(uint8_t* data, int size, uint64_t key)
+{
+    int words = size / 8;
+    if (options.mode == CorruptionMode::Overwrite) {
+        for (int i = 0; i < words; i++) {
+            uint64_t r = mix(key + (uint64_t)(i + 1) * golden_gamma);
+            std::memcpy(data + i * 8, &r, 8);
+        }
+        uint64_t r = mix(key);
+        std::memcpy(data + words * 8, &r, size - words * 8);
+    } else {
+        // One bit per byte, picked by the low 3 bits of each random byte.
+        for (int i = 0; i < words; i++) {
+            uint64_t r = mix(key + (uint64_t)(i + 1) * golden_gamma);
+            uint64_t v;
+            std::memcpy(&v, data + i * 8, 8);
+            uint64_t bits = 0;
+            for (int b = 0; b < 8; b++)
+                bits |= (uint64_t)(1u << ((r >> (b * 8)) & 7)) << (b * 8);
+            v ^= bits;
+            std::memcpy(data + i * 8, &v, 8);
+        }
+        uint64_t r = mix(key);
+        for (int i = words * 8, b = 0; i < size; i++, b++)
+            data[i] ^= (uint8_t)(1u << ((r >> (b * 8)) & 7));
+    }
+}
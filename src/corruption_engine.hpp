@@ -0,0 +1,90 @@
+#if !defined(CORRUPTION_ENGINE_HPP)
+#define CORRUPTION_ENGINE_HPP
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+/// @brief How the corrupted bytes are written.
+enum class CorruptionMode {
+    Overwrite, // replace the bytes with random values
+    BitFlip, // flip one random bit in every byte
+};
+
+/// @brief Strategy of the packet corruption.
+struct CorruptionOptions {
+    // Same seed and same input give the same output.
+    uint64_t seed = 0;
+    // Chance for a packet to be touched.
+    double probability = 1.0;
+    // Number of corrupted spans per packet.
+    int min_spans = 1;
+    int max_spans = 6;
+    // Length of every span in bytes, 0 for up to the packet size.
+    int min_length = 1;
+    int max_length = 0;
+    CorruptionMode mode = CorruptionMode::Overwrite;
+};
+
+/// @brief A span of a packet overwritten or flipped, and the key of the
+/// random numbers it got.
+struct CorruptionSpan {
+    int32_t offset;
+    int32_t length;
+    uint64_t key;
+};
+
+/// @brief Everything done to one packet, enough to do it again.
+struct CorruptionRecord {
+    // The packet, as found in the stream.
+    int stream_index = 0;
+    int64_t pts = AV_NOPTS_VALUE;
+    int64_t dts = AV_NOPTS_VALUE;
+    int64_t pos = -1;
+    std::vector<CorruptionSpan> spans;
+};
+
+/// @brief Corrupt compressed packets, reproducibly. The random numbers are
+/// counter based: every packet gets its own stream derived from the seed and
+/// the packet's position in the file, so the result does not depend on the
+/// order the packets are processed in.
+class CorruptionEngine {
+private:
+    CorruptionOptions options;
+    uint64_t counter = 0; // for packets without any timestamp or position
+    double intensity = 1; // scales the probability
+
+    // Fill the span with random bytes, 8 at a time.
+    void fill(uint8_t* data, int size, uint64_t key);
+
+public:
+    CorruptionEngine(CorruptionOptions options = {});
+
+    /// @brief Get the options in use.
+    const CorruptionOptions& get_options();
+
+    /// @brief Scale the chance of a packet to be touched. The packets
+    /// touched at a lower intensity are a subset of those at a higher one,
+    /// with the same bytes.
+    /// @param intensity from 0 to 1.
+    void set_intensity(double intensity);
+
+    /// @brief Touch the packet data. The data is made writable first.
+    /// @param packet the packet to be corrupted in place.
+    /// @param record if given, gets what was done to the packet.
+    /// @return number of bytes corrupted.
+    int64_t touch(AVPacket* packet, CorruptionRecord* record = nullptr);
+
+    /// @brief Touch a buffer, with a stream of random numbers selected by key.
+    /// @param spans if given, the touched spans are added to it.
+    /// @return number of bytes corrupted.
+    int64_t touch(uint8_t* data, int size, uint64_t key, std::vector<CorruptionSpan>* spans = nullptr);
+
+    /// @brief Do the recorded spans again, with the same bytes.
+    /// @return number of bytes corrupted.
+    int64_t replay(AVPacket* packet, const std::vector<CorruptionSpan>& spans);
+};
+#endif // CORRUPTION_ENGINE_HPP
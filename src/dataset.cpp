@@ -0,0 +1,292 @@
+#include "dataset.hpp"
+#include "file_io.hpp"
+#include "metrics.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[8] = { 'G', 'L', 'I', 'T', 'C', 'H', 'D', 'S' };
+static const uint32_t version = 1;
+static const size_t header_size = 16;
+static const size_t buffer_limit = 8 << 20;
+
+static std::filesystem::path chunk_path(const std::filesystem::path& dir, uint32_t chunk)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "data-%05u.bin", chunk);
+    return dir / name;
+}
+
+static off_t file_size(int fd)
+{
+    struct stat info;
+    return fstat(fd, &info) < 0 ? -1 : info.st_size;
+}
+
+DatasetWriter::DatasetWriter(const std::filesystem::path& dir, DatasetEncoding encoding, const EncoderSettings& jpeg, uint64_t chunk_size)
+    : dir(dir)
+    , encoding(encoding)
+    , jpeg(jpeg)
+    , chunk_size(chunk_size)
+{
+    this->jpeg.format = ImageFormat::Jpeg;
+    std::filesystem::create_directories(dir);
+    index_fd = open((dir / "index.bin").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    sources_fd = open((dir / "sources.txt").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd < 0 or sources_fd < 0 or !recover()) {
+        std::cerr << "Cannot open the dataset: " << dir.string() << std::endl;
+        failed = true;
+    }
+}
+
+DatasetWriter::~DatasetWriter()
+{
+    flush();
+    for (int fd : { index_fd, data_fd, sources_fd }) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+// Keep the valid prefix of an existing dataset, and get ready to append.
+bool DatasetWriter::recover()
+{
+    // Sources: drop a line written half.
+    off_t size = file_size(sources_fd);
+    std::string text(size, '\0');
+    if (size > 0 and pread(sources_fd, text.data(), size, 0) != size)
+        return false;
+    size_t end = text.rfind('\n');
+    text.resize(end == std::string::npos ? 0 : end + 1);
+    if (ftruncate(sources_fd, text.size()) < 0 or lseek(sources_fd, 0, SEEK_END) < 0)
+        return false;
+    size_t start = 0;
+    for (size_t line = text.find('\n'); line != std::string::npos; line = text.find('\n', start)) {
+        sources.emplace(text.substr(start, line - start), (uint32_t)sources.size());
+        start = line + 1;
+    }
+
+    // Index: a new one gets the header, an old one loses its torn tail and
+    // the records pointing past the end of their data.
+    size = file_size(index_fd);
+    if (size < (off_t)header_size) {
+        uint8_t header[header_size] = {};
+        std::memcpy(header, magic, 8);
+        std::memcpy(header + 8, &version, 4);
+        uint32_t record_size = sizeof(DatasetRecord);
+        std::memcpy(header + 12, &record_size, 4);
+        if (ftruncate(index_fd, 0) < 0 or pwrite(index_fd, header, header_size, 0) != (ssize_t)header_size)
+            return false;
+        lseek(index_fd, header_size, SEEK_SET);
+        return open_chunk(0);
+    }
+    char found[8];
+    if (pread(index_fd, found, 8, 0) != 8 or std::memcmp(found, magic, 8) != 0)
+        return false;
+    records = (size - header_size) / sizeof(DatasetRecord);
+    DatasetRecord last {};
+    while (records > 0) {
+        if (pread(index_fd, &last, sizeof(last), header_size + (records - 1) * sizeof(last)) != sizeof(last))
+            return false;
+        std::error_code error;
+        uintmax_t data_size = std::filesystem::file_size(chunk_path(dir, last.chunk), error);
+        if (!error and last.offset + last.size <= data_size and last.source < sources.size())
+            break;
+        records--;
+    }
+    if (ftruncate(index_fd, header_size + records * sizeof(DatasetRecord)) < 0 or lseek(index_fd, 0, SEEK_END) < 0)
+        return false;
+    chunk = records ? last.chunk : 0;
+    return open_chunk(records ? last.offset + last.size : 0);
+}
+
+// Open the current chunk for appending, cut to the given size.
+bool DatasetWriter::open_chunk(uint64_t size)
+{
+    if (data_fd >= 0)
+        close(data_fd);
+    data_fd = open(chunk_path(dir, chunk).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (data_fd < 0 or ftruncate(data_fd, size) < 0 or lseek(data_fd, size, SEEK_SET) < 0)
+        return false;
+    chunk_end = size;
+    return true;
+}
+
+// Data first, then the records pointing at it.
+bool DatasetWriter::write_buffers()
+{
+    METRICS_TIME(Stage::Write);
+    if (failed)
+        return false;
+    if (!write_all(data_fd, data_buffer.data(), data_buffer.size()) or !write_all(index_fd, index_buffer.data(), index_buffer.size())) {
+        std::cerr << "Cannot write the dataset: " << std::strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+    data_buffer.clear();
+    index_buffer.clear();
+    return true;
+}
+
+bool DatasetWriter::is_valid()
+{
+    return !failed;
+}
+
+uint64_t DatasetWriter::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return records;
+}
+
+bool DatasetWriter::write(const std::filesystem::path&, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat)
+{
+    // Encode outside of the lock.
+    thread_local ImageEncoder encoder;
+    thread_local std::vector<uint8_t> encoded;
+    if (encoding == DatasetEncoding::Jpeg and !encoder.encode(image, jpeg, encoded))
+        return false;
+    size_t row_size = (size_t)image.cols * image.elemSize();
+    size_t size = encoding == DatasetEncoding::Jpeg ? encoded.size() : row_size * image.rows;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed)
+        return false;
+
+    // A new source is on disk before any record that refers to it.
+    std::string source = video_file.string();
+    auto found = sources.find(source);
+    if (found == sources.end()) {
+        std::string line = source + "\n";
+        if (!write_all(sources_fd, (const uint8_t*)line.data(), line.size())) {
+            failed = true;
+            return false;
+        }
+        found = sources.emplace(source, (uint32_t)sources.size()).first;
+    }
+
+    // The next chunk, when this one is full.
+    if (chunk_end > 0 and chunk_end + size > chunk_size) {
+        if (!write_buffers())
+            return false;
+        chunk++;
+        if (!open_chunk(0)) {
+            failed = true;
+            return false;
+        }
+    }
+
+    DatasetRecord record {};
+    record.offset = chunk_end;
+    record.size = (uint32_t)size;
+    record.chunk = chunk;
+    record.source = found->second;
+    record.frame = frame_number;
+    record.width = (uint16_t)image.cols;
+    record.height = (uint16_t)image.rows;
+    record.channels = (uint8_t)image.channels();
+    record.encoding = encoding;
+    if (encoding == DatasetEncoding::Jpeg) {
+        data_buffer.insert(data_buffer.end(), encoded.begin(), encoded.end());
+    } else {
+        for (int y = 0; y < image.rows; y++)
+            data_buffer.insert(data_buffer.end(), image.ptr(y), image.ptr(y) + row_size);
+    }
+    const uint8_t* bytes = (const uint8_t*)&record;
+    index_buffer.insert(index_buffer.end(), bytes, bytes + sizeof(record));
+    chunk_end += size;
+    records++;
+    return data_buffer.size() < buffer_limit or write_buffers();
+}
+
+bool DatasetWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!write_buffers())
+        return false;
+    return fdatasync(data_fd) == 0 and fdatasync(sources_fd) == 0 and fdatasync(index_fd) == 0;
+}
+
+static bool map_file(const std::filesystem::path& path, uint8_t*& data, size_t& size)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    off_t length = file_size(fd);
+    void* mapped = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return length == 0;
+    data = static_cast<uint8_t*>(mapped);
+    size = length;
+    return true;
+}
+
+DatasetReader::DatasetReader(const std::filesystem::path& dir)
+{
+    if (!map_file(dir / "index.bin", index.data, index.size) or index.size < header_size or std::memcmp(index.data, magic, 8) != 0) {
+        std::cerr << "Cannot open the dataset: " << dir.string() << std::endl;
+        return;
+    }
+    std::ifstream list { dir / "sources.txt" };
+    for (std::string line; std::getline(list, line);)
+        sources.push_back(line);
+
+    records = reinterpret_cast<const DatasetRecord*>(index.data + header_size);
+    count = (index.size - header_size) / sizeof(DatasetRecord);
+    for (size_t i = 0; i < count; i++) {
+        const DatasetRecord& r = records[i];
+        while (chunks.size() <= r.chunk) {
+            Mapping mapping;
+            map_file(chunk_path(dir, (uint32_t)chunks.size()), mapping.data, mapping.size);
+            chunks.push_back(mapping);
+        }
+        if (r.offset + r.size > chunks[r.chunk].size or r.source >= sources.size()) {
+            count = i;
+            break;
+        }
+    }
+}
+
+DatasetReader::~DatasetReader()
+{
+    for (Mapping& mapping : chunks) {
+        if (mapping.data)
+            munmap(mapping.data, mapping.size);
+    }
+    if (index.data)
+        munmap(index.data, index.size);
+}
+
+size_t DatasetReader::size()
+{
+    return count;
+}
+
+const DatasetRecord& DatasetReader::record(size_t i)
+{
+    return records[i];
+}
+
+const std::string& DatasetReader::source(size_t i)
+{
+    return sources[records[i].source];
+}
+
+const uint8_t* DatasetReader::data(size_t i)
+{
+    return chunks[records[i].chunk].data + records[i].offset;
+}
+
+cv::Mat DatasetReader::image(size_t i)
+{
+    const DatasetRecord& r = records[i];
+    if (r.encoding == DatasetEncoding::Jpeg)
+        return cv::imdecode(cv::Mat(1, (int)r.size, CV_8UC1, (void*)data(i)), cv::IMREAD_COLOR);
+    return cv::Mat(r.height, r.width, CV_8UC(r.channels), (void*)data(i));
+}
@@ -0,0 +1,126 @@
+#if !defined(DATASET_HPP)
+#define DATASET_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image_sink.hpp"
+
+// A dataset is a folder of append-only files:
+//   index.bin      16 byte header, then one DatasetRecord per image
+//   data-NNNNN.bin the images back to back, a new chunk every chunk_size bytes
+//   sources.txt    the source videos, one per line, referenced by line number
+// All numbers are little endian. Data is always written before the records
+// pointing at it, so a killed run leaves a valid prefix; opening the dataset
+// again cuts off whatever was written half.
+
+/// @brief How the images are stored.
+enum class DatasetEncoding : uint8_t {
+    Raw = 0, // uint8 height x width x channels, BGR
+    Jpeg = 1,
+};
+
+/// @brief One image in the index, 32 bytes.
+struct DatasetRecord {
+    uint64_t offset; // in the data chunk
+    uint32_t size; // bytes
+    uint32_t chunk; // NNNNN of the data file
+    uint32_t source; // line in sources.txt, from 0
+    int32_t frame; // frame number in the source video
+    uint16_t width;
+    uint16_t height;
+    uint8_t channels;
+    DatasetEncoding encoding;
+    uint16_t reserved;
+};
+static_assert(sizeof(DatasetRecord) == 32, "the index layout is fixed");
+
+/// @brief Append images to a dataset, from any number of threads. Small
+/// writes are collected in memory and written sequentially.
+class DatasetWriter : public ImageSink {
+private:
+    std::filesystem::path dir;
+    DatasetEncoding encoding;
+    EncoderSettings jpeg;
+    uint64_t chunk_size;
+
+    std::mutex mutex;
+    int index_fd = -1, data_fd = -1, sources_fd = -1;
+    uint32_t chunk = 0;
+    uint64_t chunk_end = 0; // where the next image goes, including the buffer
+    std::vector<uint8_t> data_buffer, index_buffer;
+    std::map<std::string, uint32_t> sources;
+    uint64_t records = 0;
+    bool failed = false;
+
+    bool recover();
+    bool open_chunk(uint64_t size);
+    bool write_buffers();
+
+public:
+    /// @brief Open a dataset, creating it or appending to it.
+    /// @param dir the dataset folder.
+    /// @param encoding how new images are stored.
+    /// @param jpeg quality and subsampling, for Jpeg.
+    /// @param chunk_size max size of a data file in bytes.
+    DatasetWriter(const std::filesystem::path& dir, DatasetEncoding encoding = DatasetEncoding::Raw, const EncoderSettings& jpeg = {}, uint64_t chunk_size = 1ULL << 30);
+    ~DatasetWriter();
+    DatasetWriter(const DatasetWriter&) = delete;
+    DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+    /// @brief Check if the dataset could be opened.
+    bool is_valid();
+
+    /// @brief Get the number of images in the dataset.
+    uint64_t size();
+
+    /// @brief Append an image. It is in the index once flushed.
+    bool write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format) override;
+
+    /// @brief Write everything buffered and sync it to the disk.
+    /// @return true if success.
+    bool flush() override;
+};
+
+/// @brief Read a dataset through memory maps, without copying the images.
+class DatasetReader {
+private:
+    struct Mapping {
+        uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+    Mapping index;
+    std::vector<Mapping> chunks;
+    std::vector<std::string> sources;
+    const DatasetRecord* records = nullptr;
+    size_t count = 0;
+
+public:
+    /// @brief Open a dataset. Records past the end of the data, from a run
+    /// that was killed, are left out.
+    explicit DatasetReader(const std::filesystem::path& dir);
+    ~DatasetReader();
+    DatasetReader(const DatasetReader&) = delete;
+    DatasetReader& operator=(const DatasetReader&) = delete;
+
+    /// @brief Get the number of images.
+    size_t size();
+
+    /// @brief Get the record of an image.
+    const DatasetRecord& record(size_t i);
+
+    /// @brief Get the source video of an image.
+    const std::string& source(size_t i);
+
+    /// @brief Get the stored bytes of an image, raw pixels or a JPEG.
+    const uint8_t* data(size_t i);
+
+    /// @brief Get an image. Raw images are wrapped without copying and stay
+    /// valid as long as the reader; JPEG images are decoded.
+    cv::Mat image(size_t i);
+};
+#endif // DATASET_HPP
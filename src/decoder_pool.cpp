@@ -0,0 +1,68 @@
+#include "decoder_pool.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+
+DecoderPool::DecoderPool(size_t capacity)
+    : capacity(std::max<size_t>(1, capacity))
+{
+}
+
+DecoderPool::~DecoderPool()
+{
+    for (auto&& [key, contexts] : idle)
+        free_contexts(contexts);
+    for (auto&& [type, device] : devices)
+        av_buffer_unref(&device);
+}
+
+void DecoderPool::free_contexts(Contexts& contexts)
+{
+    if (contexts.codec)
+        avcodec_free_context(&contexts.codec);
+    if (contexts.sws)
+        sws_freeContext(contexts.sws);
+    contexts.sws = nullptr;
+}
+
+DecoderPool::Contexts DecoderPool::take(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    // The newest first, its SWS context most likely fits as well.
+    for (size_t i = idle.size(); i-- > 0;) {
+        if (idle[i].first != key)
+            continue;
+        Contexts contexts = idle[i].second;
+        idle.erase(idle.begin() + i);
+        METRICS_COUNT(Counter::ContextsReused, 1);
+        return contexts;
+    }
+    return {};
+}
+
+void DecoderPool::give(const std::string& key, Contexts contexts)
+{
+    if (!contexts.codec)
+        return;
+    avcodec_flush_buffers(contexts.codec);
+    std::lock_guard<std::mutex> lock { mutex };
+    idle.emplace_back(key, contexts);
+    if (idle.size() > capacity) {
+        free_contexts(idle.front().second);
+        idle.erase(idle.begin());
+    }
+}
+
+AVBufferRef* DecoderPool::device(AVHWDeviceType type)
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    auto found = devices.find(type);
+    if (found == devices.end()) {
+        // A failure is kept too, trying again for every video costs as much.
+        AVBufferRef* device = nullptr;
+        if (av_hwdevice_ctx_create(&device, type, nullptr, nullptr, 0) < 0)
+            device = nullptr;
+        found = devices.emplace(type, device).first;
+    }
+    return found->second ? av_buffer_ref(found->second) : nullptr;
+}
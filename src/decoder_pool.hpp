@@ -0,0 +1,56 @@
+#if !defined(DECODER_POOL_HPP)
+#define DECODER_POOL_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/hwcontext.h"
+#include "libswscale/swscale.h"
+}
+
+/// @brief Opened decoder contexts and hardware devices kept across videos.
+/// Opening a decoder can take longer than decoding a clip of a few seconds.
+/// A decoder for a video with the same codec parameters as an earlier one
+/// starts from the contexts that one gave back instead. Thread safe.
+class DecoderPool {
+public:
+    /// @brief The contexts of one decoder.
+    struct Contexts {
+        AVCodecContext* codec = nullptr; // opened
+        SwsContext* sws = nullptr; // may be null
+    };
+
+private:
+    std::mutex mutex;
+    size_t capacity;
+    std::vector<std::pair<std::string, Contexts>> idle; // oldest first
+    std::map<AVHWDeviceType, AVBufferRef*> devices; // null if it cannot be created
+
+    static void free_contexts(Contexts& contexts);
+
+public:
+    /// @param capacity the max number of idle contexts kept, the oldest are
+    /// freed first.
+    explicit DecoderPool(size_t capacity = 16);
+    DecoderPool(const DecoderPool&) = delete;
+    DecoderPool& operator=(const DecoderPool&) = delete;
+    ~DecoderPool();
+
+    /// @brief Take idle contexts opened with the given key.
+    /// @param key the codec parameters and decoder options, see VideoDecoder.
+    /// @return the contexts, or null ones if there are none.
+    Contexts take(const std::string& key);
+
+    /// @brief Give contexts back for later decoders. The codec context is
+    /// flushed, so no frame of this video comes out of the next one.
+    void give(const std::string& key, Contexts contexts);
+
+    /// @brief Get a hardware device, created on the first call.
+    /// @return a new reference to the device, null if it cannot be created.
+    AVBufferRef* device(AVHWDeviceType type);
+};
+#endif // DECODER_POOL_HPP
@@ -0,0 +1,170 @@
+#include "exporter.hpp"
+#include "run_log.hpp"
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+// Memory taken from a budget, given back on every return.
+struct BudgetLease {
+    ResourceBudget* budget;
+    size_t amount;
+    ~BudgetLease()
+    {
+        if (budget)
+            budget->release(amount);
+    }
+};
+
+} // namespace
+
+std::vector<int64_t> split_chunks(const VideoIndex& index, int chunks)
+{
+    // A chunk starts at the first keyframe past its share of the frames.
+    std::vector<int64_t> starts { INT64_MIN };
+    size_t frames_per_chunk = index.frames.size() / std::max(1, chunks) + 1;
+    for (auto&& keyframe : index.keyframes) {
+        size_t position = index.frame_number(keyframe) - 1;
+        if (position >= frames_per_chunk * starts.size())
+            starts.push_back(keyframe);
+    }
+    return starts;
+}
+
+int export_range(const std::string& url, const ExportSettings& settings, const VideoIndex* index, int64_t start, int64_t end)
+{
+    // The decoder scales into its own pool of BGR frames, unless there are
+    // several sizes to make.
+    std::vector<ExportLevel> levels = settings.levels;
+    if (levels.empty())
+        levels.push_back({ settings.geometry, settings.format, "" });
+    DecoderOptions options = settings.decoder;
+    options.output = largest_geometry(levels);
+
+    // Decoded surfaces: the reference frames plus one per decoding thread.
+    // Taken before the decoder is opened, so the budget caps the number of
+    // open decoders too. The size comes from the index, or from a look at
+    // the container, 1080p if neither knows.
+    size_t memory = 0;
+    if (settings.memory) {
+        std::pair<int, int> dims = index ? std::make_pair(index->width, index->height) : probe_frame_dims(url);
+        if (dims.first <= 0 or dims.second <= 0)
+            dims = { 1920, 1080 };
+        int threads = settings.decoder.threads > 0 ? settings.decoder.threads : std::thread::hardware_concurrency();
+        int held = settings.score.enabled() ? settings.score.top : 0;
+        memory = settings.memory->acquire((size_t)dims.first * dims.second * 3 / 2 * (16 + threads + held));
+    }
+    BudgetLease lease { settings.memory, memory };
+
+    // A resumed range starts after the checkpoint, with the corruption of
+    // the run that wrote the log.
+    std::unique_ptr<RunLog> log;
+    if (settings.resume) {
+        log = std::make_unique<RunLog>(run_log_path(settings.export_dir, start), options.corruption, true);
+        if (!log->is_valid())
+            return -1;
+        if (log->is_finished())
+            return 0;
+        RunLog::Checkpoint checkpoint = log->get_checkpoint();
+        if (checkpoint.pts != AV_NOPTS_VALUE)
+            start = std::max(start, checkpoint.pts + 1);
+        options.log = log.get();
+        if (options.corruption.seed != settings.decoder.corruption.seed)
+            std::cout << "Corruption seed of " << url << " from its log: " << options.corruption.seed << std::endl;
+    }
+    VideoDecoder decoder { url, settings.hw_acc, options };
+    if (!decoder.is_valid())
+        return -1;
+
+    // With an index, only the GOPs holding selected frames are decoded, and
+    // frames are numbered by their place in it, the same as in chunks.
+    // Scanning the packets costs little next to decoding them.
+    VideoIndex own_index;
+    if (!index and url != "-") {
+        own_index = decoder.build_index();
+        index = &own_index;
+    }
+    if (decoder.select(settings.selection, index, start, end) < 0)
+        return -1;
+
+    std::filesystem::path video_file { url };
+    ImageFileSink files;
+    ImageSink& sink = settings.sink ? *settings.sink : files;
+    FramePyramid pyramid { levels };
+    EffectChain effects { settings.effects, log ? options.corruption.seed : settings.effects_seed };
+    std::vector<cv::Mat> images;
+    FramePtr frame;
+    int exported = 0;
+    auto write_images = [&](int frame_number) {
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (sink.write(settings.export_dir / levels[i].name, video_file, frame_number, images[i], levels[i].format))
+                exported++;
+        }
+    };
+
+    // Scored frames stay in their native format until they are picked, the
+    // others are never converted.
+    bool scoring = settings.score.enabled();
+    FrameScorer scorer;
+    FramePicker picker { settings.score };
+    std::vector<ScoredFrame> picked;
+    auto export_picked = [&] {
+        for (auto&& scored : picked) {
+            if (pyramid.convert(scored.frame.get(), images, &effects, scored.frame_number) == 0)
+                write_images(scored.frame_number);
+        }
+        picked.clear();
+    };
+
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(settings.checkpoint_interval));
+    auto next_checkpoint = std::chrono::steady_clock::now() + interval;
+    bool written = true; // every image flushed so far made it to disk
+    int ret;
+    while ((ret = decoder.grab_selected(settings.touch)) == 0) {
+        // Leading frames of an open GOP belong to the chunk before, the
+        // selection leaves them out by their timestamp.
+        int frame_number = decoder.get_frame_number();
+        int64_t pts = decoder.get_frame_pts();
+        if (scoring) {
+            ScoredFrame scored { nullptr, frame_number, pts };
+            if (decoder.retrieve(scored.frame) < 0)
+                continue;
+            scored.score = scorer.score(scored.frame.get(), frame_number).total;
+            picker.offer(std::move(scored), picked);
+            export_picked();
+            FramePicker::Position settled = picker.settled();
+            frame_number = settled.frame_number;
+            pts = settled.pts;
+        } else if (levels.size() == 1) {
+            if (decoder.retrieve_bgr(frame) < 0)
+                continue;
+            images.assign(1, frame_to_mat(frame.get()));
+            effects.apply(images[0], frame_number);
+            write_images(frame_number);
+        } else if (decoder.retrieve(frame) < 0 or pyramid.convert(frame.get(), images, &effects, frame_number) < 0) {
+            continue;
+        } else {
+            write_images(frame_number);
+        }
+
+        // The checkpoint is only written once every image up to it is out.
+        if (log and pts != AV_NOPTS_VALUE and std::chrono::steady_clock::now() >= next_checkpoint) {
+            if (sink.flush())
+                log->checkpoint(frame_number, pts);
+            else
+                written = false;
+            next_checkpoint = std::chrono::steady_clock::now() + interval;
+        }
+    }
+    picker.finish(picked);
+    export_picked();
+    written = sink.flush() and written;
+    if (log and ret == -1 and written)
+        log->finish();
+    if (!written) {
+        std::cerr << "Some images of " << url << " could not be written." << std::endl;
+        return -1;
+    }
+    return exported;
+}
@@ -0,0 +1,66 @@
+#if !defined(EXPORTER_HPP)
+#define EXPORTER_HPP
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "frame_pyramid.hpp"
+#include "frame_scorer.hpp"
+#include "image_sink.hpp"
+#include "thread_pool.hpp"
+#include "video_decoder.hpp"
+
+/// @brief What to export, and where.
+struct ExportSettings {
+    std::filesystem::path export_dir;
+    DecoderOptions decoder;
+    AVHWDeviceType hw_acc = AV_HWDEVICE_TYPE_CUDA;
+    OutputGeometry geometry;
+    ImageFormat format = ImageFormat::Jpeg;
+    // Several sizes from the same frames. If given, geometry and format are
+    // not used.
+    std::vector<ExportLevel> levels;
+    // Every 150th frame by default.
+    FrameSelection selection = FrameSelection::every_nth(150);
+    // If enabled, the selected frames are only candidates, and the glitchy
+    // ones among them are exported.
+    ScoreOptions score;
+    bool touch = true;
+    // Pixel effects on every exported frame, keyed by its number.
+    std::vector<Effect> effects;
+    uint64_t effects_seed = 0;
+
+    // Keep a log of the corruptions and checkpoints next to the images, and
+    // carry on after the checkpoint of an earlier run's log.
+    bool resume = false;
+    double checkpoint_interval = 10; // seconds
+
+    // If given, every running decoder takes its estimated memory from it.
+    ResourceBudget* memory = nullptr;
+
+    // Where the images go, one file per image if not given.
+    ImageSink* sink = nullptr;
+};
+
+/// @brief Split the stream at keyframes into chunks with about the same
+/// number of frames.
+/// @return the start timestamp of every chunk, the first one is INT64_MIN.
+std::vector<int64_t> split_chunks(const VideoIndex& index, int chunks);
+
+/// @brief Decode a range of the video and export the selected frames, on
+/// the calling thread.
+/// @param url the video file.
+/// @param settings what to export, and where.
+/// @param index the index of the stream, built here if not given. Frames
+/// are numbered by their place in it, only a pipe falls back to the
+/// timestamps.
+/// @param start the first timestamp of the range, INT64_MIN for the start of the stream.
+/// @param end the timestamp after the range, INT64_MAX for the end of the stream.
+/// @return number of images exported, negative for errors, like an image
+/// that could not be written. A range finished by an earlier run exports
+/// nothing.
+int export_range(const std::string& url, const ExportSettings& settings, const VideoIndex* index = nullptr,
+    int64_t start = INT64_MIN, int64_t end = INT64_MAX);
+#endif // EXPORTER_HPP
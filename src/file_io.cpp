@@ -0,0 +1,18 @@
+#include "file_io.hpp"
+
+#include <cerrno>
+#include <unistd.h>
+
+bool write_all(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
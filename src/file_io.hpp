@@ -0,0 +1,11 @@
+#if !defined(FILE_IO_HPP)
+#define FILE_IO_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Write a whole buffer to a file descriptor, carrying on after
+/// short writes and interrupts.
+/// @return true if every byte was written, else false with errno set.
+bool write_all(int fd, const uint8_t* data, size_t size);
+#endif // FILE_IO_HPP
@@ -0,0 +1,180 @@
+#include "frame_converter.hpp"
+#include "metrics.hpp"
+
+#include <thread>
+
+// Source formats with a dedicated kernel.
+static bool yuv_layout(AVPixelFormat format, YuvLayout& layout)
+{
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        layout = YuvLayout::Yuv420p;
+        return true;
+    case AV_PIX_FMT_NV12:
+        layout = YuvLayout::Nv12;
+        return true;
+    case AV_PIX_FMT_YUV420P10LE:
+        layout = YuvLayout::Yuv420p10;
+        return true;
+    default:
+        return false;
+    }
+}
+
+FrameConverter::FrameConverter(OutputGeometry geometry)
+    : geometry(geometry)
+{
+}
+
+FrameConverter::~FrameConverter()
+{
+    if (ctx_sws)
+        sws_freeContext(ctx_sws);
+}
+
+SwsContext* FrameConverter::release_context()
+{
+    SwsContext* ctx = ctx_sws;
+    ctx_sws = nullptr;
+    return ctx;
+}
+
+void FrameConverter::adopt_context(SwsContext* ctx)
+{
+    if (ctx_sws)
+        sws_freeContext(ctx_sws);
+    ctx_sws = ctx;
+}
+
+void FrameConverter::set_geometry(const OutputGeometry& geometry)
+{
+    this->geometry = geometry;
+}
+
+void FrameConverter::set_threads(int threads)
+{
+    this->threads = threads;
+}
+
+cv::Size FrameConverter::output_size(int src_width, int src_height) const
+{
+    if (geometry.width > 0 and geometry.height > 0)
+        return { geometry.width, geometry.height };
+    if (geometry.crop == CropMode::Roi and geometry.roi.width > 0 and geometry.roi.height > 0)
+        return geometry.roi.size();
+    return { src_width, src_height };
+}
+
+cv::Rect FrameConverter::source_roi(int src_width, int src_height, AVPixelFormat src_fmt) const
+{
+    cv::Rect full { 0, 0, src_width, src_height };
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(src_fmt);
+    if (!desc or desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))
+        return full;
+
+    cv::Rect roi = full;
+    if (geometry.crop == CropMode::Center and geometry.width > 0 and geometry.height > 0) {
+        // The same region center_crop_after_resize used to keep.
+        float scale = std::max(geometry.height / (float)src_height, geometry.width / (float)src_width);
+        roi.width = std::min(src_width, (int)std::lround(geometry.width / scale));
+        roi.height = std::min(src_height, (int)std::lround(geometry.height / scale));
+        roi.x = (src_width - roi.width) / 2;
+        roi.y = (src_height - roi.height) / 2;
+    } else if (geometry.crop == CropMode::Roi and geometry.roi.width > 0 and geometry.roi.height > 0) {
+        roi.x = std::clamp(geometry.roi.x, 0, src_width - 1);
+        roi.y = std::clamp(geometry.roi.y, 0, src_height - 1);
+        roi.width = std::min(geometry.roi.width, src_width - roi.x);
+        roi.height = std::min(geometry.roi.height, src_height - roi.y);
+    }
+
+    // Chroma planes can only be offset by whole chroma samples.
+    int align_x = (1 << desc->log2_chroma_w) - 1, align_y = (1 << desc->log2_chroma_h) - 1;
+    roi.width += roi.x & align_x;
+    roi.height += roi.y & align_y;
+    roi.x &= ~align_x;
+    roi.y &= ~align_y;
+    return roi;
+}
+
+int FrameConverter::convert(const AVFrame* src, uint8_t* dst, int dst_step)
+{
+    AVPixelFormat src_fmt = (AVPixelFormat)src->format;
+    cv::Size out_size = output_size(src->width, src->height);
+    cv::Rect roi = source_roi(src->width, src->height, src_fmt);
+    // Scaling in the same pass counts as a resize.
+    METRICS_TIME(roi.size() == out_size ? Stage::Convert : Stage::Resize);
+
+    // Point every plane at the top left corner of the crop window.
+    const uint8_t* src_data[4] = { src->data[0], src->data[1], src->data[2], src->data[3] };
+    if (roi.x != 0 or roi.y != 0) {
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(src_fmt);
+        bool done[4] = { false, false, false, false };
+        for (int c = 0; c < desc->nb_components; c++) {
+            const AVComponentDescriptor& comp = desc->comp[c];
+            if (done[comp.plane])
+                continue;
+            bool chroma = (c == 1 or c == 2) and !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+            int x = chroma ? roi.x >> desc->log2_chroma_w : roi.x;
+            int y = chroma ? roi.y >> desc->log2_chroma_h : roi.y;
+            src_data[comp.plane] += (ptrdiff_t)y * src->linesize[comp.plane] + (ptrdiff_t)x * comp.step;
+            done[comp.plane] = true;
+        }
+    }
+
+    // Color conversion only, no need for SWS.
+    YuvLayout layout;
+    if (roi.size() == out_size and (output_fmt == AV_PIX_FMT_BGR24 or output_fmt == AV_PIX_FMT_BGRA) and yuv_layout(src_fmt, layout)) {
+        YuvImage image {
+            { src_data[0], src_data[1], src_data[2] },
+            { src->linesize[0], src->linesize[1], src->linesize[2] },
+            layout,
+            roi.width,
+            roi.height,
+            src_fmt == AV_PIX_FMT_YUVJ420P or src->color_range == AVCOL_RANGE_JPEG
+        };
+        int band_threads = threads;
+        if (band_threads <= 0)
+            band_threads = roi.area() >= 3840 * 2160 ? std::min(4u, std::max(1u, std::thread::hardware_concurrency())) : 1;
+        yuv_to_bgr(image, dst, dst_step, output_fmt == AV_PIX_FMT_BGRA ? BgrLayout::Bgra : BgrLayout::Bgr24, band_threads);
+        return 0;
+    }
+
+    ctx_sws = sws_getCachedContext(ctx_sws,
+        roi.width,
+        roi.height,
+        src_fmt,
+        out_size.width,
+        out_size.height,
+        output_fmt,
+        geometry.interpolation,
+        nullptr,
+        nullptr,
+        nullptr);
+    if (ctx_sws == nullptr) {
+        std::cerr << "Cannot init SWS context." << std::endl;
+        return -1;
+    }
+
+    uint8_t* dst_data[4] = { dst, nullptr, nullptr, nullptr };
+    int dst_linesize[4] = { dst_step, 0, 0, 0 };
+    int out_height = sws_scale(ctx_sws,
+        src_data,
+        src->linesize,
+        0,
+        roi.height,
+        dst_data,
+        dst_linesize);
+    if (out_height != out_size.height) {
+        std::cerr << "Cannot convert image, out height: " << out_height << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int FrameConverter::convert(const AVFrame* src, cv::Mat& dst)
+{
+    cv::Size out_size = output_size(src->width, src->height);
+    dst.create(out_size.height, out_size.width, CV_8UC3);
+    return convert(src, dst.data, dst.step[0]);
+}
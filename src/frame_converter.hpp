@@ -0,0 +1,86 @@
+#if !defined(FRAME_CONVERTER_HPP)
+#define FRAME_CONVERTER_HPP
+
+#include "opencv2/opencv.hpp"
+#include "yuv_convert.hpp"
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+/// @brief How the source frame is fitted into the output size.
+enum class CropMode {
+    Stretch, // scale the whole frame, ignoring the aspect ratio
+    Center, // scale to cover the output, then crop the center
+    Roi, // scale the given source region
+};
+
+/// @brief The size and region of the converted frame.
+struct OutputGeometry {
+    // Output size, 0 for the source size.
+    int width = 0;
+    int height = 0;
+    CropMode crop = CropMode::Center;
+    // Source region in pixels, used by CropMode::Roi.
+    cv::Rect roi;
+    // SWS interpolation flag, like SWS_BICUBIC or SWS_AREA.
+    int interpolation = SWS_BICUBIC;
+};
+
+/// @brief Convert decoded frames (like YUV420) to BGR. Scaling and cropping
+/// are done in the same SWS pass, reading only the source pixels inside the
+/// crop window. Without scaling, the common 4:2:0 formats go through the
+/// SIMD kernels of yuv_convert instead. Each instance owns its own SWS
+/// context, so different threads can convert at the same time.
+class FrameConverter {
+private:
+    SwsContext* ctx_sws = nullptr;
+    AVPixelFormat output_fmt = AV_PIX_FMT_BGR24;
+    OutputGeometry geometry;
+
+    // Threads for converting large frames without scaling.
+    int threads = 0;
+
+public:
+    FrameConverter(OutputGeometry geometry = {});
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+    ~FrameConverter();
+
+    /// @brief Set the output geometry for the following conversions.
+    void set_geometry(const OutputGeometry& geometry);
+
+    /// @brief Set the number of threads converting bands of rows, when no
+    /// scaling is needed. 0 picks a few threads for 4K and larger frames.
+    void set_threads(int threads);
+
+    /// @brief Hand the SWS context over to another converter, see
+    /// adopt_context().
+    /// @return the context, null if none was made yet.
+    SwsContext* release_context();
+
+    /// @brief Take over a SWS context. It is kept if it fits the next
+    /// conversion, else replaced.
+    void adopt_context(SwsContext* ctx);
+
+    /// @brief Get the output size for a source of the given size.
+    cv::Size output_size(int src_width, int src_height) const;
+
+    /// @brief Get the source region to be converted, aligned to the chroma
+    /// subsampling of the pixel format.
+    cv::Rect source_roi(int src_width, int src_height, AVPixelFormat src_fmt) const;
+
+    /// @brief Convert a frame into a buffer of the output size.
+    /// @param src the decoded frame in system memory.
+    /// @param dst the pixel buffer.
+    /// @param dst_step the row size of the pixel buffer in bytes.
+    /// @return 0 if success, else negative.
+    int convert(const AVFrame* src, uint8_t* dst, int dst_step);
+
+    /// @brief Convert a frame into a BGR image, allocated if necessary.
+    /// @return 0 if success, else negative.
+    int convert(const AVFrame* src, cv::Mat& dst);
+};
+#endif // FRAME_CONVERTER_HPP
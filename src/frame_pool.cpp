@@ -0,0 +1,90 @@
+#include "frame_pool.hpp"
+
+#include <iostream>
+
+// Every buffer handed out wraps a pooled one, to count it back in.
+struct Lease {
+    std::shared_ptr<void> shared;
+    AVBufferRef* pooled;
+};
+
+FramePool::Shared::~Shared()
+{
+    av_buffer_pool_uninit(&pool);
+}
+
+FramePool::FramePool(int capacity)
+    : shared(std::make_shared<Shared>())
+{
+    shared->capacity = std::max(1, capacity);
+}
+
+void FramePool::release(void* opaque, uint8_t*)
+{
+    Lease* lease = static_cast<Lease*>(opaque);
+    av_buffer_unref(&lease->pooled);
+    Shared* state = static_cast<Shared*>(lease->shared.get());
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->in_use--;
+    }
+    state->released.notify_one();
+    delete lease;
+}
+
+int FramePool::get(AVFrame* frame, AVPixelFormat format, int width, int height)
+{
+    const int align = 32;
+    int size = av_image_get_buffer_size(format, width, height, align);
+    if (size < 0)
+        return size;
+
+    AVBufferRef* pooled = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        // A new layout starts a new pool. The old one is freed once its
+        // buffers are all back.
+        if (!shared->pool or format != this->format or width != this->width or height != this->height) {
+            av_buffer_pool_uninit(&shared->pool);
+            shared->pool = av_buffer_pool_init(size, nullptr);
+            this->format = format;
+            this->width = width;
+            this->height = height;
+        }
+        shared->released.wait(lock, [this] { return shared->in_use < shared->capacity; });
+        pooled = av_buffer_pool_get(shared->pool);
+        if (!pooled) {
+            std::cerr << "Cannot allocate frame buffer." << std::endl;
+            return AVERROR(ENOMEM);
+        }
+        shared->in_use++;
+    }
+
+    Lease* lease = new Lease { shared, pooled };
+    frame->buf[0] = av_buffer_create(pooled->data, pooled->size, release, lease, 0);
+    if (!frame->buf[0]) {
+        release(lease, nullptr);
+        return AVERROR(ENOMEM);
+    }
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    return av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, format, width, height, align);
+}
+
+int FramePool::capacity()
+{
+    return shared->capacity;
+}
+
+int FramePool::in_use()
+{
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    return shared->in_use;
+}
+
+cv::Mat frame_to_mat(const AVFrame* frame)
+{
+    int channels = frame->format == AV_PIX_FMT_BGRA ? 4 : frame->format == AV_PIX_FMT_GRAY8 ? 1 : 3;
+    return cv::Mat(frame->height, frame->width, CV_8UC(channels), frame->data[0], frame->linesize[0]);
+}
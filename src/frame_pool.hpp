@@ -0,0 +1,66 @@
+#if !defined(FRAME_POOL_HPP)
+#define FRAME_POOL_HPP
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "opencv2/opencv.hpp"
+
+extern "C" {
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+}
+
+/// @brief A pool of ref-counted frame buffers, backed by AVBufferPool. The
+/// frames handed out share their buffer by reference: they can be passed to
+/// other threads and are returned to the pool when the last reference is
+/// gone. At most `capacity` buffers are in use at once; asking for one more
+/// waits until a frame is released, which keeps a slow consumer from piling
+/// up frames.
+class FramePool {
+private:
+    // Outlives the pool object as long as any buffer is still out.
+    struct Shared {
+        std::mutex mutex;
+        std::condition_variable released;
+        int in_use = 0;
+        int capacity;
+        AVBufferPool* pool = nullptr;
+        ~Shared();
+    };
+    std::shared_ptr<Shared> shared;
+
+    // Layout of the pooled buffers.
+    AVPixelFormat format = AV_PIX_FMT_NONE;
+    int width = 0;
+    int height = 0;
+
+    static void release(void* opaque, uint8_t* data);
+
+public:
+    /// @brief Create a pool.
+    /// @param capacity the max number of buffers in use at once, including
+    /// the one being written.
+    explicit FramePool(int capacity = 8);
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /// @brief Get a buffer for the frame, waiting while all of them are in
+    /// use. Buffers are recycled as long as the layout stays the same.
+    /// @param frame an empty frame, its data, format and size are set.
+    /// @return 0 if success, else negative.
+    int get(AVFrame* frame, AVPixelFormat format, int width, int height);
+
+    /// @brief Get the max number of buffers in use at once.
+    int capacity();
+
+    /// @brief Get the number of buffers in use now.
+    int in_use();
+};
+
+/// @brief Wrap a packed frame, like BGR24, in a cv::Mat without copying. The
+/// Mat is only valid as long as a reference to the frame is held.
+cv::Mat frame_to_mat(const AVFrame* frame);
+#endif // FRAME_POOL_HPP
@@ -0,0 +1,145 @@
+#include "frame_pyramid.hpp"
+#include "metrics.hpp"
+
+#include <numeric>
+
+FramePyramid::FramePyramid(const std::vector<ExportLevel>& specs)
+    : specs(specs)
+{
+    for (auto&& spec : specs) {
+        levels.push_back(std::make_unique<Level>());
+        levels.back()->converter.set_geometry(spec.geometry);
+    }
+}
+
+size_t FramePyramid::size()
+{
+    return specs.size();
+}
+
+const ExportLevel& FramePyramid::level(size_t i)
+{
+    return specs[i];
+}
+
+// The region of a parent image showing the source region of a level.
+static cv::Rect region_in(const cv::Size& parent_size, const cv::Rect& parent_roi, const cv::Rect& roi)
+{
+    double scale_x = parent_size.width / (double)parent_roi.width;
+    double scale_y = parent_size.height / (double)parent_roi.height;
+    cv::Rect region {
+        (int)std::lround((roi.x - parent_roi.x) * scale_x),
+        (int)std::lround((roi.y - parent_roi.y) * scale_y),
+        (int)std::lround(roi.width * scale_x),
+        (int)std::lround(roi.height * scale_y)
+    };
+    return region & cv::Rect { 0, 0, parent_size.width, parent_size.height };
+}
+
+void FramePyramid::plan(int width, int height, AVPixelFormat fmt, bool effects)
+{
+    for (auto&& level : levels) {
+        level->size = level->converter.output_size(width, height);
+        level->roi = level->converter.source_roi(width, height, fmt);
+        level->parent = -1;
+    }
+    order.resize(levels.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return levels[a]->size.area() > levels[b]->size.area(); });
+
+    // Pick the smallest larger level that holds the whole source region with
+    // at least as many pixels, so resizing it only ever scales down.
+    for (size_t i = 1; i < order.size(); i++) {
+        Level& level = *levels[order[i]];
+        for (size_t j = i; j-- > 0;) {
+            const Level& parent = *levels[order[j]];
+            if ((level.roi & parent.roi) != level.roi)
+                continue;
+            cv::Rect region = region_in(parent.size, parent.roi, level.roi);
+            if (region.width < level.size.width or region.height < level.size.height)
+                continue;
+            level.parent = order[j];
+            level.parent_roi = region;
+            break;
+        }
+    }
+
+    // Levels converted each from the frame would get different glitches,
+    // give them one glitched image to be made from.
+    base.reset();
+    cv::Rect covered;
+    int roots = 0;
+    for (auto&& level : levels) {
+        if (level->parent < 0) {
+            covered |= level->roi;
+            roots++;
+        }
+    }
+    if (effects and roots > 1) {
+        base = std::make_unique<Level>();
+        OutputGeometry geometry;
+        geometry.width = covered.width;
+        geometry.height = covered.height;
+        geometry.crop = CropMode::Roi;
+        geometry.roi = covered;
+        base->converter.set_geometry(geometry);
+        base->size = base->converter.output_size(width, height);
+        base->roi = base->converter.source_roi(width, height, fmt);
+        for (auto&& level : levels) {
+            if (level->parent < 0)
+                level->parent_roi = region_in(base->size, base->roi, level->roi);
+        }
+    }
+    planned_width = width;
+    planned_height = height;
+    planned_fmt = fmt;
+    planned_effects = effects;
+}
+
+int FramePyramid::convert(const AVFrame* src, std::vector<cv::Mat>& dst, EffectChain* effects, uint64_t key)
+{
+    bool with_effects = effects and !effects->empty();
+    if (src->width != planned_width or src->height != planned_height or src->format != planned_fmt or with_effects != planned_effects)
+        plan(src->width, src->height, (AVPixelFormat)src->format, with_effects);
+    if (base) {
+        if (base->converter.convert(src, base_image) < 0)
+            return -1;
+        effects->apply(base_image, key);
+    }
+    dst.resize(levels.size());
+    for (int i : order) {
+        Level& level = *levels[i];
+        if (level.parent < 0 and !base) {
+            if (level.converter.convert(src, dst[i]) < 0)
+                return -1;
+            if (with_effects)
+                effects->apply(dst[i], key);
+            continue;
+        }
+        cv::Mat region = level.parent < 0 ? base_image(level.parent_roi) : dst[level.parent](level.parent_roi);
+        if (region.size() == level.size) {
+            dst[i] = region;
+            continue;
+        }
+        METRICS_TIME(Stage::Resize);
+        bool shrink = region.cols >= level.size.width and region.rows >= level.size.height;
+        cv::resize(region, dst[i], level.size, 0, 0, shrink ? cv::INTER_AREA : cv::INTER_LINEAR);
+    }
+    return 0;
+}
+
+OutputGeometry largest_geometry(const std::vector<ExportLevel>& levels)
+{
+    OutputGeometry largest;
+    if (levels.empty())
+        return largest;
+    largest = levels[0].geometry;
+    for (auto&& level : levels) {
+        const OutputGeometry& geometry = level.geometry;
+        if (geometry.width <= 0 or geometry.height <= 0)
+            return geometry;
+        if (geometry.width * geometry.height > largest.width * largest.height)
+            largest = geometry;
+    }
+    return largest;
+}
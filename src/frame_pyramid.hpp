@@ -0,0 +1,73 @@
+#if !defined(FRAME_PYRAMID_HPP)
+#define FRAME_PYRAMID_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frame_converter.hpp"
+#include "glitch_effects.hpp"
+#include "image_encoder.hpp"
+
+/// @brief One size of the exported images.
+struct ExportLevel {
+    OutputGeometry geometry;
+    ImageFormat format = ImageFormat::Jpeg;
+    std::string name; // folder under the export dir, empty for the export dir itself
+};
+
+/// @brief Convert a decoded frame into several sizes at once. The largest
+/// levels are converted from the frame; a smaller one is resized from the
+/// smallest level already done that covers its source region at a high
+/// enough resolution, so every extra size reads only a small image. With
+/// effects and several levels converted from the frame, the region covering
+/// all of them is converted once at the source resolution and glitched, and
+/// every level is made from it instead.
+class FramePyramid {
+private:
+    struct Level {
+        FrameConverter converter;
+        cv::Size size;
+        cv::Rect roi; // in source pixels
+        int parent = -1; // level it is resized from, -1 for the frame
+        cv::Rect parent_roi; // the region of the parent to resize
+    };
+    std::vector<ExportLevel> specs;
+    std::vector<std::unique_ptr<Level>> levels;
+    std::vector<int> order; // largest first
+    std::unique_ptr<Level> base; // shared by the levels converted from the frame, if any
+    cv::Mat base_image;
+
+    // The plan depends on the source, and on the effects.
+    int planned_width = 0, planned_height = 0;
+    AVPixelFormat planned_fmt = AV_PIX_FMT_NONE;
+    bool planned_effects = false;
+    void plan(int width, int height, AVPixelFormat fmt, bool effects);
+
+public:
+    explicit FramePyramid(const std::vector<ExportLevel>& specs);
+    FramePyramid(const FramePyramid&) = delete;
+    FramePyramid& operator=(const FramePyramid&) = delete;
+
+    /// @brief Get the number of levels.
+    size_t size();
+
+    /// @brief Get a level, in the order given.
+    const ExportLevel& level(size_t i);
+
+    /// @brief Convert a frame into every level.
+    /// @param src the decoded frame in system memory.
+    /// @param dst the BGR images, in the order of the levels. Smaller levels
+    /// may share pixels with larger ones, treat them as read only.
+    /// @param effects if given, applied once to the largest image converted
+    /// from the frame, before the other sizes are made from it, so every size
+    /// shows the same glitches.
+    /// @param key picks the glitches of this frame.
+    /// @return 0 if success, else negative.
+    int convert(const AVFrame* src, std::vector<cv::Mat>& dst, EffectChain* effects = nullptr, uint64_t key = 0);
+};
+
+/// @brief Get the geometry asking the most of the decoder, for picking its
+/// shortcuts: the source size if any level wants it, else the largest level.
+OutputGeometry largest_geometry(const std::vector<ExportLevel>& levels);
+#endif // FRAME_PYRAMID_HPP
@@ -0,0 +1,192 @@
+#include "frame_scorer.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+extern "C" {
+#include "libavutil/pixdesc.h"
+}
+
+namespace {
+
+// Macroblocks of most codecs, where a corrupted slice shows first.
+const int block = 16;
+
+// One component of a frame, read as 8 bits.
+struct Component {
+    const uint8_t* data = nullptr;
+    int linesize = 0;
+    int step = 1;
+    bool wide = false; // 16 bit samples
+    int shift = 0; // of wide samples, down to 8 bits
+
+    int at(int x, int y) const
+    {
+        const uint8_t* p = data + (ptrdiff_t)y * linesize + (ptrdiff_t)x * step;
+        if (!wide)
+            return *p;
+        uint16_t value;
+        std::memcpy(&value, p, 2);
+        return (value >> shift) & 0xff;
+    }
+};
+
+bool get_component(const AVFrame* frame, const AVPixFmtDescriptor* desc, int c, Component& out)
+{
+    const AVComponentDescriptor& comp = desc->comp[c];
+    if (comp.depth > 16 or !frame->data[comp.plane])
+        return false;
+    out.data = frame->data[comp.plane] + comp.offset;
+    out.linesize = frame->linesize[comp.plane];
+    out.step = comp.step;
+    out.wide = comp.depth > 8;
+    out.shift = out.wide ? comp.shift + comp.depth - 8 : 0;
+    return true;
+}
+
+// How far above its running average a value is, and update the average.
+float spike(float value, float& average, float scale)
+{
+    if (average < 0)
+        average = value;
+    float above = (value - average) / scale;
+    average += (value - average) / 16;
+    return std::clamp(above, 0.0f, 1.0f);
+}
+
+} // namespace
+
+FrameScore FrameScorer::score(const AVFrame* frame, int frame_number)
+{
+    METRICS_TIME(Stage::Score);
+    FrameScore result;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    const uint64_t unsupported = AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE;
+    int cols = frame->width / block, rows = frame->height / block;
+    Component luma, u, v;
+    if (!desc or desc->flags & unsupported or cols < 2 or rows < 2 or !get_component(frame, desc, 0, luma)) {
+        result.total = std::numeric_limits<float>::infinity();
+        return result;
+    }
+    bool chroma = desc->nb_components >= 3 and get_component(frame, desc, 1, u) and get_component(frame, desc, 2, v);
+
+    // Two rows of every macroblock, at a quarter and three quarters of its
+    // height. The luma gradient across the block edges is compared with the
+    // gradient between two pixels inside, which is not on the edge of any
+    // 4x4 or 8x8 transform either.
+    thumbnail.resize((size_t)cols * rows);
+    uint64_t edges = 0, inside = 0;
+    int vivid = 0;
+    for (int by = 0; by < rows; by++) {
+        int y0 = by * block;
+        for (int bx = 0; bx < cols; bx++) {
+            int x0 = bx * block, sum = 0;
+            for (int r : { 4, 12 }) {
+                int y = y0 + r;
+                for (int x = x0; x < x0 + block; x += 2)
+                    sum += luma.at(x, y);
+                if (bx > 0) {
+                    edges += std::abs(luma.at(x0, y) - luma.at(x0 - 1, y));
+                    inside += std::abs(luma.at(x0 + 6, y) - luma.at(x0 + 5, y));
+                }
+                if (by > 0) {
+                    int x = x0 + r;
+                    edges += std::abs(luma.at(x, y0) - luma.at(x, y0 - 1));
+                    inside += std::abs(luma.at(x, y0 + 6) - luma.at(x, y0 + 5));
+                }
+            }
+            thumbnail[(size_t)by * cols + bx] = (uint8_t)((sum + 8) / 16);
+
+            // Broken chroma is mostly vivid green or magenta.
+            if (chroma) {
+                int cx = (x0 + block / 2) >> desc->log2_chroma_w, cy = (y0 + block / 2) >> desc->log2_chroma_h;
+                vivid += std::abs(u.at(cx, cy) - 128) + std::abs(v.at(cx, cy) - 128) > 64;
+            }
+        }
+    }
+    int samples = 2 * (cols - 1) * rows + 2 * cols * (rows - 1);
+    float edge = (float)edges / samples, inner = (float)inside / samples;
+    result.blockiness = std::clamp((edge - inner) / (inner + 8), 0.0f, 1.0f);
+
+    // Motion of natural video comes and goes smoothly, a glitch makes it jump.
+    if (frame_number == last_frame_number + 1 and previous.size() == thumbnail.size()) {
+        uint64_t difference = 0;
+        for (size_t i = 0; i < thumbnail.size(); i++)
+            difference += std::abs(thumbnail[i] - previous[i]);
+        result.motion = spike((float)difference / thumbnail.size(), motion_average, 16);
+    }
+    previous.swap(thumbnail);
+    last_frame_number = frame_number;
+
+    if (chroma)
+        result.saturation = spike((float)vivid / (cols * rows), saturation_average, 0.25f);
+    result.total = 0.5f * result.blockiness + 0.25f * result.motion + 0.25f * result.saturation;
+    return result;
+}
+
+bool ScoreOptions::enabled() const
+{
+    return threshold > 0 or top > 0;
+}
+
+FramePicker::FramePicker(const ScoreOptions& options)
+    : options(options)
+{
+    this->options.window = std::max(1, options.window);
+}
+
+void FramePicker::hand_out(std::vector<ScoredFrame>& out)
+{
+    std::sort(held.begin(), held.end(), [](const ScoredFrame& a, const ScoredFrame& b) { return a.frame_number < b.frame_number; });
+    for (auto&& frame : held)
+        out.push_back(std::move(frame));
+    held.clear();
+}
+
+void FramePicker::offer(ScoredFrame frame, std::vector<ScoredFrame>& out)
+{
+    Position position { frame.frame_number, frame.pts };
+    bool wanted = frame.score >= options.threshold;
+    if (options.top <= 0) {
+        if (wanted)
+            out.push_back(std::move(frame));
+        else
+            METRICS_COUNT(Counter::LowScoreFrames, 1);
+        last = done = position;
+        return;
+    }
+
+    // A frame of the next window settles every frame before it.
+    int64_t number = (frame.frame_number - 1) / options.window;
+    if (number != window) {
+        hand_out(out);
+        done = last;
+        window = number;
+    }
+    last = position;
+    if (!wanted) {
+        METRICS_COUNT(Counter::LowScoreFrames, 1);
+        return;
+    }
+    if ((int)held.size() < options.top) {
+        held.push_back(std::move(frame));
+        return;
+    }
+    auto worst = std::min_element(held.begin(), held.end(), [](const ScoredFrame& a, const ScoredFrame& b) { return a.score < b.score; });
+    if (frame.score > worst->score)
+        *worst = std::move(frame);
+    METRICS_COUNT(Counter::LowScoreFrames, 1);
+}
+
+void FramePicker::finish(std::vector<ScoredFrame>& out)
+{
+    hand_out(out);
+    done = last;
+}
+
+FramePicker::Position FramePicker::settled() const
+{
+    return done;
+}
@@ -0,0 +1,96 @@
+#if !defined(FRAME_SCORER_HPP)
+#define FRAME_SCORER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "video_decoder.hpp"
+
+/// @brief How visibly glitched a frame is. Each part is between 0 and 1, 0
+/// for a clean frame.
+struct FrameScore {
+    float blockiness = 0; // luma edges on the macroblock grid, stronger than inside the blocks
+    float motion = 0; // change from the previous frame, beyond the usual change
+    float saturation = 0; // more vivid colors than the frames before
+    float total = 0; // weighted sum of the above
+};
+
+/// @brief Score decoded frames in their native pixel format, before any
+/// conversion. Only a coarse sample of the planes is read: two rows of
+/// every 16x16 macroblock and one chroma sample at its center, about a
+/// 1/16 of a 1080p frame. The motion and saturation are relative to the
+/// frames scored before, so the frames of a video must come in order.
+class FrameScorer {
+private:
+    std::vector<uint8_t> thumbnail; // mean luma of every macroblock
+    std::vector<uint8_t> previous; // of the last frame
+    int last_frame_number = -1;
+    float motion_average = -1; // running averages, -1 before the first frame
+    float saturation_average = -1;
+
+public:
+    /// @brief Score a frame. Frames without 8 bit or little endian 16 bit
+    /// YUV planes cannot be scored and get an infinite total, so they are
+    /// always picked.
+    /// @param frame the decoded frame in system memory.
+    /// @param frame_number counting from 1. A gap drops the previous frame,
+    /// the motion across a seek means nothing.
+    FrameScore score(const AVFrame* frame, int frame_number);
+};
+
+/// @brief Which scored frames to export.
+struct ScoreOptions {
+    // Frames scoring less are never exported.
+    float threshold = 0;
+    // The best frames of every window, 0 for every frame above the threshold.
+    int top = 0;
+    // Frames per window, by frame number.
+    int window = 150;
+
+    /// @brief Check if frames are scored at all.
+    bool enabled() const;
+};
+
+/// @brief A decoded frame waiting for the picker's decision.
+struct ScoredFrame {
+    FramePtr frame; // native pixel format
+    int frame_number = 0;
+    int64_t pts = AV_NOPTS_VALUE;
+    float score = 0;
+};
+
+/// @brief Pick the frames to export by their score. Frames above the
+/// threshold are picked at once, or with a top K, held until their window
+/// is over. Only the K best of a window are ever held.
+class FramePicker {
+public:
+    /// @brief A frame up to which every frame is either handed out or
+    /// dropped, a safe checkpoint.
+    struct Position {
+        int frame_number = 0;
+        int64_t pts = AV_NOPTS_VALUE;
+    };
+
+private:
+    ScoreOptions options;
+    std::vector<ScoredFrame> held; // of the current window
+    int64_t window = INT64_MIN; // of the held frames
+    Position last; // the last frame offered
+    Position done;
+
+    void hand_out(std::vector<ScoredFrame>& out);
+
+public:
+    explicit FramePicker(const ScoreOptions& options);
+
+    /// @brief Offer the next frame.
+    /// @param out gets the frames picked and ready, in frame order.
+    void offer(ScoredFrame frame, std::vector<ScoredFrame>& out);
+
+    /// @brief Hand out the frames held for the last window.
+    void finish(std::vector<ScoredFrame>& out);
+
+    /// @brief Get the last frame that is settled, see Position.
+    Position settled() const;
+};
+#endif // FRAME_SCORER_HPP
@@ -0,0 +1,263 @@
+#include "config.h"
+#include "glitch_effects.hpp"
+#include "glitch_effects_kernel.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// SplitMix64 finalizer, the generator of the corruption engine.
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static const uint64_t golden_gamma = 0x9e3779b97f4a7c15ULL;
+
+namespace {
+
+struct Random {
+    uint64_t state;
+    uint64_t next() { return mix(state += golden_gamma); }
+    // In [low, high].
+    int uniform(int low, int high) { return low + (int)(next() % (uint64_t)(high - low + 1)); }
+    // In [0, 1).
+    float unit() { return (next() >> 40) * (1.0f / (1 << 24)); }
+};
+
+void shift_channels(const uint8_t* src, uint8_t* dst, int bytes, int blue, int red)
+{
+    shift_channels_scalar(src, dst, 0, bytes, blue, red);
+}
+
+void quantize(uint8_t* data, int bytes, int bits)
+{
+    quantize_scalar(data, 0, bytes, bits);
+}
+
+// 16 rows of 1080p are about 90 KB, well inside L2.
+const int band_rows = 16;
+
+} // namespace
+
+Effect default_effect(EffectType type)
+{
+    switch (type) {
+    case EffectType::ChannelShift:
+        return { type, 1.0f, 6 };
+    case EffectType::RowShift:
+        return { type, 0.2f, 64 };
+    case EffectType::BlockShift:
+        return { type, 0.2f, 32 };
+    case EffectType::ScanlineTear:
+        return { type, 0.3f, 48 };
+    case EffectType::PixelSort:
+        return { type, 0.1f, 96 };
+    case EffectType::Quantize:
+        return { type, 1.0f, 3 };
+    }
+    return { type, 0.0f, 0 };
+}
+
+EffectChain::EffectChain(std::vector<Effect> effects, uint64_t seed, SimdLevel level)
+    : effects(std::move(effects))
+    , seed(seed)
+    , kernels { shift_channels, quantize }
+{
+#if defined(HAVE_X86_SIMD)
+    if (std::min(level, simd_level()) >= SimdLevel::AVX2)
+        kernels = { shift_channels_avx2, quantize_avx2 };
+#endif
+    for (auto&& effect : this->effects) {
+        effect.amount = std::clamp(effect.amount, 0.0f, 1.0f);
+        if (effect.type == EffectType::Quantize)
+            effect.strength = std::clamp(effect.strength, 1, 7);
+        else if (effect.type == EffectType::PixelSort)
+            effect.strength = std::clamp(effect.strength, 0, 255);
+        else
+            effect.strength = std::max(effect.strength, 1);
+    }
+    plans.resize(this->effects.size());
+}
+
+bool EffectChain::empty() const
+{
+    return effects.empty();
+}
+
+void EffectChain::plan(size_t i, uint64_t key, int width, int height)
+{
+    const Effect& effect = effects[i];
+    std::vector<int>& rows = plans[i];
+    rows.assign(height, none);
+    Random random { mix(seed ^ mix(key + (i + 1) * golden_gamma)) };
+
+    if (effect.type == EffectType::ScanlineTear) {
+        // The shear fades out below every tear, with a little jitter.
+        int tears = 1 + (int)(effect.amount * 8);
+        for (int t = 0; t < tears; t++) {
+            int top = random.uniform(0, height - 1);
+            int length = random.uniform(height / 16 + 1, height / 4 + 1);
+            int amplitude = random.uniform(-effect.strength, effect.strength);
+            for (int y = top; y < std::min(height, top + length); y++) {
+                int dx = amplitude * (top + length - y) / length + random.uniform(-2, 2);
+                rows[y] = (rows[y] == none ? 0 : rows[y]) + dx;
+            }
+        }
+        return;
+    }
+
+    // Bands of 4 to 64 rows, each picked with the chance of the amount.
+    for (int y = 0; y < height;) {
+        int end = std::min(height, y + random.uniform(4, 64));
+        bool picked = random.unit() < effect.amount;
+        int value = effect.strength;
+        if (effect.type == EffectType::ChannelShift)
+            value = random.uniform(1, std::min(effect.strength, width));
+        else if (effect.type == EffectType::RowShift)
+            value = random.uniform(-effect.strength, effect.strength);
+        if (picked)
+            std::fill(rows.begin() + y, rows.begin() + end, value);
+        y = end;
+    }
+}
+
+void EffectChain::shift_row(uint8_t* row, int width, int dx)
+{
+    dx = (dx % width + width) % width;
+    if (dx == 0)
+        return;
+    size_t bytes = (size_t)width * 3, moved = (size_t)dx * 3;
+    scratch.resize(bytes);
+    std::memcpy(scratch.data(), row, bytes);
+    std::memcpy(row + moved, scratch.data(), bytes - moved);
+    std::memcpy(row, scratch.data() + bytes - moved, moved);
+}
+
+void EffectChain::sort_row(uint8_t* row, int width, int threshold)
+{
+    luma.resize(width);
+    for (int x = 0; x < width; x++) {
+        const uint8_t* p = row + x * 3;
+        luma[x] = (uint8_t)((29 * p[0] + 150 * p[1] + 77 * p[2]) >> 8);
+    }
+
+    // Every run brighter than the threshold is sorted darkest first, by a
+    // counting sort on 32 levels of brightness. Sorting a few pixels shows
+    // nothing, short runs are left alone.
+    for (int x = 0; x < width;) {
+        if (luma[x] <= threshold) {
+            x++;
+            continue;
+        }
+        int end = x + 1;
+        while (end < width and luma[end] > threshold)
+            end++;
+        int length = end - x;
+        if (length >= 8) {
+            int starts[33] = {};
+            for (int i = x; i < end; i++)
+                starts[(luma[i] >> 3) + 1]++;
+            for (int level = 1; level < 33; level++)
+                starts[level] += starts[level - 1];
+            scratch.resize((size_t)length * 3);
+            std::memcpy(scratch.data(), row + x * 3, (size_t)length * 3);
+            for (int i = 0; i < length; i++)
+                std::memcpy(row + (x + starts[luma[x + i] >> 3]++) * 3, scratch.data() + i * 3, 3);
+        }
+        x = end;
+    }
+}
+
+void EffectChain::apply_rows(cv::Mat& image, uint64_t key, size_t first, size_t last)
+{
+    const int width = image.cols, bytes = image.cols * 3;
+    for (size_t i = first; i < last; i++)
+        plan(i, key, image.cols, image.rows);
+
+    for (int top = 0; top < image.rows; top += band_rows) {
+        int bottom = std::min(image.rows, top + band_rows);
+        for (size_t i = first; i < last; i++) {
+            const EffectType type = effects[i].type;
+            const std::vector<int>& rows = plans[i];
+            for (int y = top; y < bottom; y++) {
+                int value = rows[y];
+                if (value == none)
+                    continue;
+                uint8_t* row = image.ptr(y);
+                switch (type) {
+                case EffectType::ChannelShift: {
+                    // Edge pixels repeated on both sides, so every load is
+                    // inside the row.
+                    size_t pad = (size_t)value * 3;
+                    scratch.resize(bytes + pad * 2);
+                    uint8_t* middle = scratch.data() + pad;
+                    std::memcpy(middle, row, bytes);
+                    for (size_t p = 0; p < pad; p += 3) {
+                        std::memcpy(scratch.data() + p, row, 3);
+                        std::memcpy(middle + bytes + p, row + bytes - 3, 3);
+                    }
+                    kernels.shift_channels(middle, row, bytes, -value * 3, value * 3);
+                    break;
+                }
+                case EffectType::RowShift:
+                case EffectType::ScanlineTear:
+                    shift_row(row, width, value);
+                    break;
+                case EffectType::PixelSort:
+                    sort_row(row, width, value);
+                    break;
+                case EffectType::Quantize:
+                    kernels.quantize(row, bytes, value);
+                    break;
+                case EffectType::BlockShift:
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void EffectChain::shift_blocks(cv::Mat& image, uint64_t key, size_t i)
+{
+    const Effect& effect = effects[i];
+    Random random { mix(seed ^ mix(key + (i + 1) * golden_gamma)) };
+    int size = std::max(2, effect.strength);
+    int blocks = std::max(1, (int)(effect.amount * 32));
+    for (int b = 0; b < blocks; b++) {
+        int w = std::min(image.cols, random.uniform(size, size * 4));
+        int h = std::min(image.rows, random.uniform(size / 2, size * 2));
+        int sx = random.uniform(0, image.cols - w), sy = random.uniform(0, image.rows - h);
+        int dx = std::clamp(sx + random.uniform(-size * 4, size * 4), 0, image.cols - w);
+        int dy = std::clamp(sy + random.uniform(-size * 4, size * 4), 0, image.rows - h);
+
+        // Through the scratch buffer, the two blocks may overlap.
+        size_t row_bytes = (size_t)w * 3;
+        scratch.resize(row_bytes * h);
+        for (int y = 0; y < h; y++)
+            std::memcpy(scratch.data() + row_bytes * y, image.ptr(sy + y) + sx * 3, row_bytes);
+        for (int y = 0; y < h; y++)
+            std::memcpy(image.ptr(dy + y) + dx * 3, scratch.data() + row_bytes * y, row_bytes);
+    }
+}
+
+void EffectChain::apply(cv::Mat& image, uint64_t key)
+{
+    if (effects.empty() or image.empty() or image.type() != CV_8UC3)
+        return;
+    METRICS_TIME(Stage::Effects);
+
+    // Runs of row effects, split by the block shifts.
+    size_t first = 0;
+    for (size_t i = 0; i <= effects.size(); i++) {
+        if (i < effects.size() and effects[i].type != EffectType::BlockShift)
+            continue;
+        if (first < i)
+            apply_rows(image, key, first, i);
+        if (i < effects.size())
+            shift_blocks(image, key, i);
+        first = i + 1;
+    }
+}
@@ -0,0 +1,79 @@
+#if !defined(GLITCH_EFFECTS_HPP)
+#define GLITCH_EFFECTS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "yuv_convert.hpp"
+
+/// @brief Glitches made on the pixels, after decoding.
+enum class EffectType {
+    ChannelShift, // blue and red pulled apart sideways
+    RowShift, // bands of rows moved sideways
+    BlockShift, // blocks copied to another place
+    ScanlineTear, // rows sheared below a tear, like a lost sync
+    PixelSort, // runs of bright pixels sorted by brightness
+    Quantize, // fewer levels per channel
+};
+
+/// @brief One effect of a chain.
+struct Effect {
+    EffectType type;
+    // Share of the frame affected, from 0 to 1: of the rows, or of the
+    // blocks and tears to make.
+    float amount;
+    // Shift or block size in pixels, the brightness threshold of PixelSort,
+    // or the bits Quantize drops.
+    int strength;
+};
+
+/// @brief Get an effect with its default amount and strength.
+Effect default_effect(EffectType type);
+
+/// @brief A chain of pixel effects, applied in place to BGR images. The
+/// random choices come from the seed and a key per frame, so a frame gets
+/// the same glitches on every run. Effects working row by row run together
+/// on bands of rows while they are in cache; BlockShift moves pixels across
+/// rows and runs between them on the whole image.
+/// Not thread safe, the buffers are reused from frame to frame.
+class EffectChain {
+private:
+    struct Kernels {
+        // dst[i] = src[i + offset of its channel], blue, green and red.
+        void (*shift_channels)(const uint8_t* src, uint8_t* dst, int bytes, int blue, int red);
+        // Keep the high bits, set the rest to half a step.
+        void (*quantize)(uint8_t* data, int bytes, int bits);
+    };
+    std::vector<Effect> effects;
+    uint64_t seed;
+    Kernels kernels;
+
+    // Parameter of every row per effect, rows left out hold `none`.
+    static constexpr int none = INT32_MIN;
+    std::vector<std::vector<int>> plans;
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> luma;
+
+    void plan(size_t i, uint64_t key, int width, int height);
+    void apply_rows(cv::Mat& image, uint64_t key, size_t first, size_t last);
+    void shift_blocks(cv::Mat& image, uint64_t key, size_t i);
+    void shift_row(uint8_t* row, int width, int dx);
+    void sort_row(uint8_t* row, int width, int threshold);
+
+public:
+    /// @param effects the chain, applied in order.
+    /// @param seed the same seed and key give the same glitches.
+    /// @param level the kernels to use, clamped to what the CPU supports.
+    EffectChain(std::vector<Effect> effects = {}, uint64_t seed = 0, SimdLevel level = simd_level());
+
+    bool empty() const;
+
+    /// @brief Apply the chain to an image.
+    /// @param image a CV_8UC3 image, changed in place. Other types are left
+    /// as they are.
+    /// @param key picks the glitches, the frame number for instance.
+    void apply(cv::Mat& image, uint64_t key);
+};
+#endif // GLITCH_EFFECTS_HPP
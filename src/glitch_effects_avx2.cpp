@@ -0,0 +1,63 @@
+#include "config.h"
+#include "glitch_effects_kernel.hpp"
+
+#include <immintrin.h>
+
+namespace {
+
+// Byte masks of the blue and red channels for a 32 byte vector starting at
+// channel `phase`. Plain bytes, so nothing runs before the CPU is checked.
+struct ChannelMasks {
+    alignas(32) uint8_t blue[3][32] = {};
+    alignas(32) uint8_t red[3][32] = {};
+    constexpr ChannelMasks()
+    {
+        for (int phase = 0; phase < 3; phase++) {
+            for (int j = 0; j < 32; j++) {
+                blue[phase][j] = (phase + j) % 3 == 0 ? 0x80 : 0;
+                red[phase][j] = (phase + j) % 3 == 2 ? 0x80 : 0;
+            }
+        }
+    }
+};
+
+constexpr ChannelMasks masks;
+
+inline void shift_vector(const uint8_t* src, uint8_t* dst, int blue, int red, __m256i blue_mask, __m256i red_mask)
+{
+    __m256i g = _mm256_loadu_si256((const __m256i*)src);
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + blue));
+    __m256i r = _mm256_loadu_si256((const __m256i*)(src + red));
+    __m256i v = _mm256_blendv_epi8(g, b, blue_mask);
+    _mm256_storeu_si256((__m256i*)dst, _mm256_blendv_epi8(v, r, red_mask));
+}
+
+} // namespace
+
+void shift_channels_avx2(const uint8_t* src, uint8_t* dst, int bytes, int blue, int red)
+{
+    // Three vectors cover 32 pixels, starting on channels 0, 2 and 1.
+    __m256i b[3], r[3];
+    for (int phase = 0; phase < 3; phase++) {
+        b[phase] = _mm256_load_si256((const __m256i*)masks.blue[phase]);
+        r[phase] = _mm256_load_si256((const __m256i*)masks.red[phase]);
+    }
+    int i = 0;
+    for (; i + 96 <= bytes; i += 96) {
+        shift_vector(src + i, dst + i, blue, red, b[0], r[0]);
+        shift_vector(src + i + 32, dst + i + 32, blue, red, b[2], r[2]);
+        shift_vector(src + i + 64, dst + i + 64, blue, red, b[1], r[1]);
+    }
+    shift_channels_scalar(src, dst, i, bytes, blue, red);
+}
+
+void quantize_avx2(uint8_t* data, int bytes, int bits)
+{
+    const __m256i keep = _mm256_set1_epi8((char)(0xff << bits)), half = _mm256_set1_epi8((char)(1 << (bits - 1)));
+    int i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_or_si256(_mm256_and_si256(v, keep), half));
+    }
+    quantize_scalar(data, i, bytes, bits);
+}
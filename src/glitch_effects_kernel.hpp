@@ -0,0 +1,34 @@
+#if !defined(GLITCH_EFFECTS_KERNEL_HPP)
+#define GLITCH_EFFECTS_KERNEL_HPP
+
+// Kernels shared by the glitch_effects*.cpp files, the vector ones finish
+// their rows with these.
+
+#include <cstdint>
+
+namespace {
+
+inline void shift_channels_scalar(const uint8_t* src, uint8_t* dst, int from, int bytes, int blue, int red)
+{
+    // `from` is a multiple of 3 in every caller, so i % 3 is the channel.
+    for (int i = from; i + 3 <= bytes; i += 3) {
+        dst[i] = src[i + blue];
+        dst[i + 1] = src[i + 1];
+        dst[i + 2] = src[i + 2 + red];
+    }
+}
+
+inline void quantize_scalar(uint8_t* data, int from, int bytes, int bits)
+{
+    const uint8_t keep = (uint8_t)(0xff << bits), half = (uint8_t)(1 << (bits - 1));
+    for (int i = from; i < bytes; i++)
+        data[i] = (uint8_t)((data[i] & keep) | half);
+}
+
+} // namespace
+
+#if defined(HAVE_X86_SIMD)
+void shift_channels_avx2(const uint8_t* src, uint8_t* dst, int bytes, int blue, int red);
+void quantize_avx2(uint8_t* data, int bytes, int bits);
+#endif
+#endif // GLITCH_EFFECTS_KERNEL_HPP
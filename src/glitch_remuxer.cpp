@@ -0,0 +1,140 @@
+#include "glitch_remuxer.hpp"
+#include "metrics.hpp"
+
+#include <iostream>
+
+GlitchRemuxer::GlitchRemuxer(const std::string input_url, const std::string output_url, CorruptionOptions corruption)
+    : corruption(corruption)
+{
+    // Init the flags
+    this->initialized = true;
+
+    // Is this file valid?
+    if (avformat_open_input(&ctx_input, input_url.c_str(), nullptr, nullptr) < 0) {
+        std::cerr << "Cannot open input file:" << input_url << std::endl;
+        initialized = false;
+        return;
+    }
+    if (avformat_find_stream_info(ctx_input, nullptr) < 0) {
+        std::cerr << "Cannot find stream information." << std::endl;
+        initialized = false;
+        return;
+    }
+    if ((video_index = av_find_best_stream(ctx_input, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0)) < 0) {
+        std::cerr << "Cannot find valid stream: " << av_get_media_type_string(AVMEDIA_TYPE_VIDEO) << std::endl;
+        initialized = false;
+        return;
+    }
+    std::cout << "Found video stream with index: " << video_index << std::endl;
+
+    // The output container is guessed from the file name.
+    if (avformat_alloc_output_context2(&ctx_output, nullptr, nullptr, output_url.c_str()) < 0 or !ctx_output) {
+        std::cerr << "Cannot create output context for: " << output_url << std::endl;
+        initialized = false;
+        return;
+    }
+
+    // Stream copy everything the muxer can carry.
+    stream_mapping.assign(ctx_input->nb_streams, -1);
+    int output_index = 0;
+    for (unsigned int i = 0; i < ctx_input->nb_streams; i++) {
+        AVCodecParameters* codecpar = ctx_input->streams[i]->codecpar;
+        if (codecpar->codec_type != AVMEDIA_TYPE_VIDEO
+            and codecpar->codec_type != AVMEDIA_TYPE_AUDIO
+            and codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE)
+            continue;
+        AVStream* stream = avformat_new_stream(ctx_output, nullptr);
+        if (!stream or avcodec_parameters_copy(stream->codecpar, codecpar) < 0) {
+            std::cerr << "Cannot copy stream: " << i << std::endl;
+            initialized = false;
+            return;
+        }
+        stream->codecpar->codec_tag = 0;
+        stream->time_base = ctx_input->streams[i]->time_base;
+        stream_mapping[i] = output_index++;
+    }
+
+    // Open the output file.
+    if (!(ctx_output->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&ctx_output->pb, output_url.c_str(), AVIO_FLAG_WRITE) < 0) {
+            std::cerr << "Cannot open output file: " << output_url << std::endl;
+            initialized = false;
+            return;
+        }
+    }
+    if (avformat_write_header(ctx_output, nullptr) < 0) {
+        std::cerr << "Cannot write output header." << std::endl;
+        initialized = false;
+        return;
+    }
+
+    // Init the packet
+    if (!(packet = av_packet_alloc())) {
+        std::cerr << "Cannot allocate packet." << std::endl;
+        initialized = false;
+    }
+}
+
+GlitchRemuxer::~GlitchRemuxer()
+{
+    if (packet)
+        av_packet_free(&packet);
+    if (ctx_input)
+        avformat_close_input(&ctx_input);
+    if (ctx_output) {
+        if (!(ctx_output->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&ctx_output->pb);
+        avformat_free_context(ctx_output);
+    }
+}
+
+bool GlitchRemuxer::is_valid()
+{
+    return initialized;
+}
+
+int GlitchRemuxer::run(bool touch)
+{
+    if (!initialized)
+        return -1;
+
+    int ret = 0;
+    int64_t packet_count = 0;
+    while (av_read_frame(ctx_input, packet) >= 0) {
+        int in_index = packet->stream_index;
+        if (stream_mapping[in_index] < 0) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        // Touch the data, to make it glitch!
+        if (touch and in_index == video_index) {
+            int64_t touched = corruption.touch(packet);
+            if (touched > 0) {
+                METRICS_COUNT(Counter::CorruptedPackets, 1);
+                METRICS_COUNT(Counter::CorruptedBytes, touched);
+            }
+        }
+
+        // Stream copy
+        AVStream* in_stream = ctx_input->streams[in_index];
+        AVStream* out_stream = ctx_output->streams[stream_mapping[in_index]];
+        packet->stream_index = stream_mapping[in_index];
+        av_packet_rescale_ts(packet, in_stream->time_base, out_stream->time_base);
+        packet->pos = -1;
+        ret = av_interleaved_write_frame(ctx_output, packet);
+        av_packet_unref(packet);
+        if (ret < 0) {
+            std::cerr << "Error writing packet: " << ret << std::endl;
+            return ret;
+        }
+        packet_count++;
+    }
+
+    if ((ret = av_write_trailer(ctx_output)) < 0) {
+        std::cerr << "Cannot write output trailer." << std::endl;
+        return ret;
+    }
+    std::cout << "Packets written: " << packet_count << std::endl;
+    return 0;
+}
@@ -0,0 +1,47 @@
+#if !defined(GLITCH_REMUXER_HPP)
+#define GLITCH_REMUXER_HPP
+
+#include <string>
+#include <vector>
+
+#include "corruption_engine.hpp"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+/// @brief Write a glitched copy of a video file without decoding it. Video
+/// packets are touched in the compressed domain and stream copied into the
+/// output container, other streams pass through untouched.
+class GlitchRemuxer {
+private:
+    // Contexts
+    AVFormatContext* ctx_input = nullptr;
+    AVFormatContext* ctx_output = nullptr;
+
+    // Streams
+    int video_index = -1;
+    std::vector<int> stream_mapping; // input index -> output index, -1 if dropped
+
+    // Packet
+    AVPacket* packet = nullptr;
+    CorruptionEngine corruption;
+
+    // Some flags
+    bool initialized = false;
+
+public:
+    GlitchRemuxer(const std::string input_url, const std::string output_url, CorruptionOptions corruption = {});
+    ~GlitchRemuxer();
+
+    /// @brief check if the remuxer was successfully initialized.
+    /// @return true if the remuxer is valid, else false.
+    bool is_valid();
+
+    /// @brief Copy all the packets to the output file.
+    /// @param touch if true, the video packets will be touched randomly.
+    /// @return 0 if success, else negative.
+    int run(bool touch = true);
+};
+#endif // GLITCH_REMUXER_HPP
@@ -0,0 +1,86 @@
+#include "image_encoder.hpp"
+#include "metrics.hpp"
+
+#include <iostream>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+const char* EncoderSettings::extension() const
+{
+    switch (format) {
+    case ImageFormat::Png:
+        return ".png";
+    case ImageFormat::Webp:
+        return ".webp";
+    default:
+        return ".jpg";
+    }
+}
+
+ImageEncoder::ImageEncoder()
+{
+#ifdef HAVE_TURBOJPEG
+    handle = tjInitCompress();
+    if (!handle)
+        std::cerr << "Cannot init libjpeg-turbo, falling back to OpenCV: " << tjGetErrorStr() << std::endl;
+#endif
+}
+
+ImageEncoder::~ImageEncoder()
+{
+#ifdef HAVE_TURBOJPEG
+    if (handle)
+        tjDestroy(handle);
+#endif
+}
+
+bool ImageEncoder::is_turbo()
+{
+    return handle != nullptr;
+}
+
+bool ImageEncoder::encode(const cv::Mat& image, const EncoderSettings& settings, std::vector<uint8_t>& out)
+{
+    METRICS_TIME(Stage::Encode);
+#ifdef HAVE_TURBOJPEG
+    if (handle and settings.format == ImageFormat::Jpeg and (image.channels() == 3 or image.channels() == 4)) {
+        // Compress straight into the vector, sized for the worst case once.
+        static const int subsamplings[] = { TJSAMP_444, TJSAMP_422, TJSAMP_420 };
+        int subsampling = subsamplings[(int)settings.subsampling];
+        out.resize(tjBufSize(image.cols, image.rows, subsampling));
+        unsigned char* buffer = out.data();
+        unsigned long size = out.size();
+        int flags = TJFLAG_NOREALLOC | (settings.fast_dct ? TJFLAG_FASTDCT : 0);
+        if (tjCompress2(handle, image.data, image.cols, (int)image.step, image.rows, image.channels() == 4 ? TJPF_BGRX : TJPF_BGR,
+                &buffer, &size, subsampling, settings.quality, flags)
+            < 0) {
+            std::cerr << "Cannot encode the image: " << tjGetErrorStr2(handle) << std::endl;
+            return false;
+        }
+        out.resize(size);
+        return true;
+    }
+#endif
+
+    // OpenCV has no fast DCT switch, and picks the subsampling itself before 4.5.5.
+    params.clear();
+    switch (settings.format) {
+    case ImageFormat::Jpeg: {
+        params.insert(params.end(), { cv::IMWRITE_JPEG_QUALITY, settings.quality });
+#if CV_VERSION_MAJOR > 4 or (CV_VERSION_MAJOR == 4 and (CV_VERSION_MINOR > 5 or (CV_VERSION_MINOR == 5 and CV_VERSION_REVISION >= 5)))
+        static const int factors[] = { cv::IMWRITE_JPEG_SAMPLING_FACTOR_444, cv::IMWRITE_JPEG_SAMPLING_FACTOR_422, cv::IMWRITE_JPEG_SAMPLING_FACTOR_420 };
+        params.insert(params.end(), { cv::IMWRITE_JPEG_SAMPLING_FACTOR, factors[(int)settings.subsampling] });
+#endif
+        break;
+    }
+    case ImageFormat::Png:
+        params.insert(params.end(), { cv::IMWRITE_PNG_COMPRESSION, settings.png_compression });
+        break;
+    case ImageFormat::Webp:
+        params.insert(params.end(), { cv::IMWRITE_WEBP_QUALITY, settings.quality });
+        break;
+    }
+    return cv::imencode(settings.extension(), image, out, params);
+}
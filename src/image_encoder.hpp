@@ -0,0 +1,69 @@
+#if !defined(IMAGE_ENCODER_HPP)
+#define IMAGE_ENCODER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "opencv2/opencv.hpp"
+
+/// @brief File format of exported images.
+enum class ImageFormat {
+    Jpeg,
+    Png,
+    Webp,
+};
+
+/// @brief Chroma subsampling of JPEG images.
+enum class ChromaSubsampling {
+    S444, // full color resolution
+    S422, // half horizontally
+    S420, // half both ways, the smallest files
+};
+
+/// @brief How images are encoded.
+struct EncoderSettings {
+    ImageFormat format = ImageFormat::Jpeg;
+
+    // JPEG and WebP, 1 to 100.
+    int quality = 95;
+
+    // JPEG only.
+    ChromaSubsampling subsampling = ChromaSubsampling::S420;
+    bool fast_dct = false; // faster, slightly less accurate
+
+    // PNG only, 0 (fastest) to 9 (smallest).
+    int png_compression = 3;
+
+    /// @brief Get the file extension of the format, with the dot.
+    const char* extension() const;
+};
+
+/// @brief Encode BGR images. With libjpeg-turbo, JPEG images are compressed
+/// by a handle kept for the life of the encoder; everything else goes
+/// through cv::imencode. An encoder is not thread-safe, give every thread
+/// its own.
+class ImageEncoder {
+private:
+    void* handle = nullptr; // tjhandle
+    std::vector<int> params;
+
+public:
+    ImageEncoder();
+    ~ImageEncoder();
+    ImageEncoder(const ImageEncoder&) = delete;
+    ImageEncoder& operator=(const ImageEncoder&) = delete;
+
+    /// @brief Check if JPEG images are compressed by libjpeg-turbo.
+    bool is_turbo();
+
+    /// @brief Encode an image.
+    /// @param image a BGR image, 8 bits per channel.
+    /// @param settings the format and its knobs.
+    /// @param out the encoded image. Its memory is reused, keep the vector
+    /// around for the next image.
+    /// @return true if success.
+    bool encode(const cv::Mat& image, const EncoderSettings& settings, std::vector<uint8_t>& out);
+};
+#endif // IMAGE_ENCODER_HPP
@@ -0,0 +1,135 @@
+#include "image_sink.hpp"
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+std::filesystem::path image_path(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int index, const char* extension)
+{
+    std::string filename = video_file.stem().string().append("-").append(std::to_string(index)).append(extension);
+    return export_dir / std::filesystem::path { filename };
+}
+
+static bool write_file(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+{
+    METRICS_TIME(Stage::Write);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    return std::fclose(file) == 0 and written;
+}
+
+ImageFileSink::ImageFileSink(const EncoderSettings& settings)
+    : settings(settings)
+{
+}
+
+bool ImageFileSink::write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format)
+{
+    thread_local ImageEncoder encoder;
+    thread_local std::vector<uint8_t> encoded;
+    EncoderSettings format_settings = settings;
+    format_settings.format = format;
+    if (!encoder.encode(image, format_settings, encoded))
+        return false;
+    return write_file(image_path(export_dir, video_file, frame_number, format_settings.extension()), encoded);
+}
+
+AsyncImageSink::AsyncImageSink(const EncoderSettings& settings, size_t threads, size_t batch)
+    : settings(settings)
+    , batch(std::max<size_t>(1, batch))
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    capacity = threads * this->batch * 2;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back(&AsyncImageSink::run, this);
+}
+
+AsyncImageSink::~AsyncImageSink()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (auto&& worker : workers)
+        worker.join();
+}
+
+bool AsyncImageSink::write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format)
+{
+    // The image belongs to the caller, keep a copy.
+    Job job;
+    EncoderSettings format_settings = settings;
+    format_settings.format = format;
+    job.path = image_path(export_dir, video_file, frame_number, format_settings.extension());
+    job.image = image.clone();
+    job.format = format;
+    job.caller = std::this_thread::get_id();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    taken.wait(lock, [this] { return jobs.size() < capacity; });
+    job.ticket = tickets++;
+    unfinished.insert(job.ticket);
+    jobs.push_back(std::move(job));
+    lock.unlock();
+    queued.notify_one();
+    return true;
+}
+
+void AsyncImageSink::run()
+{
+    // Buffers are kept from batch to batch, so they stop growing quickly.
+    ImageEncoder encoder;
+    EncoderSettings format_settings = settings;
+    std::vector<Job> taken_jobs;
+    std::vector<std::vector<uint8_t>> encoded(batch);
+    while (true) {
+        // Take whatever is queued, up to a batch.
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [this] { return stopping or !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            size_t count = std::min(batch, jobs.size());
+            for (size_t i = 0; i < count; i++) {
+                taken_jobs.push_back(std::move(jobs.front()));
+                jobs.pop_front();
+            }
+        }
+        taken.notify_all();
+
+        // Encode the whole batch, then write it out.
+        for (size_t i = 0; i < taken_jobs.size(); i++) {
+            format_settings.format = taken_jobs[i].format;
+            if (!encoder.encode(taken_jobs[i].image, format_settings, encoded[i]))
+                encoded[i].clear();
+            taken_jobs[i].image.release();
+        }
+        for (size_t i = 0; i < taken_jobs.size(); i++) {
+            if (encoded[i].empty() or !write_file(taken_jobs[i].path, encoded[i])) {
+                std::cerr << "Cannot write the image: " << taken_jobs[i].path.string() << std::endl;
+                taken_jobs[i].failed = true;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto&& job : taken_jobs) {
+            unfinished.erase(job.ticket);
+            if (job.failed)
+                failures[job.caller]++;
+        }
+        taken_jobs.clear();
+        done.notify_all();
+    }
+}
+
+bool AsyncImageSink::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t queued_before = tickets;
+    done.wait(lock, [&] { return unfinished.empty() or *unfinished.begin() >= queued_before; });
+    return failures.erase(std::this_thread::get_id()) == 0;
+}
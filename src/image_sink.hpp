@@ -0,0 +1,96 @@
+#if !defined(IMAGE_SINK_HPP)
+#define IMAGE_SINK_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_encoder.hpp"
+#include "opencv2/opencv.hpp"
+
+/// @brief Where exported images go. Implementations must be safe to call
+/// from several export threads at once.
+class ImageSink {
+public:
+    virtual ~ImageSink() = default;
+
+    /// @brief Store one image.
+    /// @param export_dir the folder for this video, used by file based sinks.
+    /// @param video_file the source video.
+    /// @param frame_number the frame the image was taken from.
+    /// @param image a BGR image, only valid during the call.
+    /// @param format the file format, for sinks writing files.
+    /// @return true if success, or queued for writing.
+    virtual bool write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format) = 0;
+
+    /// @brief Wait until every image written so far is on disk.
+    /// @return true if all of them made it.
+    virtual bool flush() { return true; }
+};
+
+/// @brief One file per image, named `<stem>-<frame>.<ext>`, encoded on the
+/// calling thread.
+class ImageFileSink : public ImageSink {
+private:
+    EncoderSettings settings;
+
+public:
+    explicit ImageFileSink(const EncoderSettings& settings = {});
+    bool write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format) override;
+};
+
+/// @brief One file per image, encoded and written by a pool of threads so
+/// that the export threads only copy the pixels. Every worker keeps its own
+/// encoder and buffers, and takes queued images in batches.
+class AsyncImageSink : public ImageSink {
+private:
+    struct Job {
+        std::filesystem::path path;
+        cv::Mat image;
+        ImageFormat format;
+        uint64_t ticket; // order of queueing
+        std::thread::id caller; // the thread that queued it
+        bool failed = false;
+    };
+    EncoderSettings settings;
+    size_t capacity; // max number of queued images
+    size_t batch; // max number of images a worker takes at once
+
+    std::mutex mutex;
+    std::condition_variable queued, taken, done;
+    std::deque<Job> jobs;
+    uint64_t tickets = 0; // images queued so far
+    std::set<uint64_t> unfinished; // tickets queued or taken, not written yet
+    std::map<std::thread::id, size_t> failures; // images failed per caller, since its last flush
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void run();
+
+public:
+    /// @brief Start the encoders.
+    /// @param settings the knobs of every format.
+    /// @param threads number of encoders, 0 for half of the cores.
+    /// @param batch max number of images an encoder takes at once.
+    explicit AsyncImageSink(const EncoderSettings& settings = {}, size_t threads = 0, size_t batch = 8);
+    ~AsyncImageSink();
+
+    /// @brief Queue an image, waiting while the encoders are behind.
+    bool write(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int frame_number, const cv::Mat& image, ImageFormat format) override;
+
+    /// @brief Wait until every image queued before the call is written.
+    /// Images queued meanwhile by other threads are not waited for.
+    /// @return false if any image queued by the calling thread failed since
+    /// its last flush. Failures of other threads are left to their flush.
+    bool flush() override;
+};
+
+/// @brief Get the path of an exported image.
+std::filesystem::path image_path(const std::filesystem::path& export_dir, const std::filesystem::path& video_file, int index, const char* extension = ".jpg");
+#endif // IMAGE_SINK_HPP
@@ -0,0 +1,301 @@
+#include "input_source.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+InputSource::~InputSource()
+{
+    if (ctx_io) {
+        av_freep(&ctx_io->buffer);
+        avio_context_free(&ctx_io);
+    }
+}
+
+int InputSource::open_context(int buffer_size, bool seekable)
+{
+    uint8_t* buffer = (uint8_t*)av_malloc(buffer_size);
+    if (!buffer)
+        return AVERROR(ENOMEM);
+    ctx_io = avio_alloc_context(buffer, buffer_size, 0, this, read_packet, nullptr, seekable ? seek_packet : nullptr);
+    if (!ctx_io) {
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    ctx_io->seekable = seekable ? AVIO_SEEKABLE_NORMAL : 0;
+    return 0;
+}
+
+int InputSource::read_packet(void* opaque, uint8_t* buf, int size)
+{
+    InputSource* input = static_cast<InputSource*>(opaque);
+    int ret = input->read(buf, size);
+    input->stats.reads++;
+    if (ret > 0) {
+        input->stats.bytes += ret;
+        METRICS_COUNT(Counter::InputBytes, ret);
+    }
+    return ret;
+}
+
+int64_t InputSource::seek_packet(void* opaque, int64_t offset, int whence)
+{
+    InputSource* input = static_cast<InputSource*>(opaque);
+    if (!(whence & AVSEEK_SIZE)) {
+        input->stats.seeks++;
+        METRICS_COUNT(Counter::InputSeeks, 1);
+    }
+    return input->seek(offset, whence);
+}
+
+int64_t InputSource::seek(int64_t, int)
+{
+    return AVERROR(ENOSYS);
+}
+
+bool InputSource::is_valid()
+{
+    return ctx_io != nullptr;
+}
+
+AVIOContext* InputSource::get_context()
+{
+    return ctx_io;
+}
+
+InputStats InputSource::get_stats()
+{
+    return stats;
+}
+
+PipeInput::PipeInput(int fd, size_t read_ahead)
+    : fd(fd)
+    , ring(std::max<size_t>(read_ahead, 1 << 16))
+{
+    if (open_context(1 << 16, false) < 0) {
+        std::cerr << "Cannot allocate the input context." << std::endl;
+        return;
+    }
+    reader = std::thread(&PipeInput::run, this);
+}
+
+PipeInput::~PipeInput()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (reader.joinable())
+        reader.join();
+}
+
+void PipeInput::run()
+{
+    while (true) {
+        // Wait for free space, then read straight into it.
+        size_t tail, space;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return stopping or filled < ring.size(); });
+            if (stopping)
+                return;
+            tail = (head + filled) % ring.size();
+            space = std::min(ring.size() - filled, ring.size() - tail);
+        }
+
+        // Poll, so that a pipe that never ends does not block the shutdown.
+        pollfd readable { fd, POLLIN, 0 };
+        int ready = poll(&readable, 1, 100);
+        if (ready == 0 or (ready < 0 and errno == EINTR))
+            continue;
+        ssize_t n = ready < 0 ? -1 : ::read(fd, ring.data() + tail, space);
+        if (n < 0 and errno == EINTR)
+            continue;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n <= 0) {
+            if (n < 0)
+                std::cerr << "Error reading the input pipe: " << std::strerror(errno) << std::endl;
+            ended = true;
+        } else {
+            filled += n;
+        }
+        changed.notify_all();
+        if (ended)
+            return;
+    }
+}
+
+int PipeInput::read(uint8_t* buf, int size)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return filled > 0 or ended; });
+    stats.stall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (filled == 0)
+        return AVERROR_EOF;
+
+    // At most up to the end of the ring, the demuxer asks again for the rest.
+    size_t n = std::min({ (size_t)size, filled, ring.size() - head });
+    std::memcpy(buf, ring.data() + head, n);
+    head = (head + n) % ring.size();
+    filled -= n;
+    changed.notify_all();
+    return (int)n;
+}
+
+FileInput::FileInput(const std::string& path, IoMode mode, size_t window)
+    : window(std::max<size_t>(window, 1 << 20))
+{
+    struct stat info;
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 or fstat(fd, &info) < 0) {
+        std::cerr << "Cannot open input file: " << path << std::endl;
+        return;
+    }
+    size = info.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (mode == IoMode::Mmap and size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            map = static_cast<uint8_t*>(mapped);
+            madvise(map, size, MADV_SEQUENTIAL);
+        }
+    }
+
+    // Mapped data is copied out in small steps, reads from the file in
+    // large ones.
+    if (open_context(map ? 1 << 16 : 1 << 20, true) < 0) {
+        std::cerr << "Cannot allocate the input context." << std::endl;
+        return;
+    }
+    prefetcher = std::thread(&FileInput::run, this);
+}
+
+FileInput::~FileInput()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    moved.notify_all();
+    if (prefetcher.joinable())
+        prefetcher.join();
+    if (map)
+        munmap(map, size);
+    if (fd >= 0)
+        close(fd);
+}
+
+void FileInput::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // Wake up when half of the window has been read, or after a seek.
+        moved.wait(lock, [this] {
+            return stopping or position < prefetched_from or position + (int64_t)window / 2 > prefetched_to;
+        });
+        if (stopping)
+            return;
+        int64_t from = position >= prefetched_from and position <= prefetched_to ? prefetched_to : position;
+        int64_t to = std::min(size, position + (int64_t)window);
+        prefetched_from = position;
+        prefetched_to = std::max(to, position + (int64_t)window / 2 + 1);
+        if (to <= from)
+            continue;
+
+        // Only a hint, the kernel reads the pages in the background.
+        lock.unlock();
+        posix_fadvise(fd, from, to - from, POSIX_FADV_WILLNEED);
+        prefetched += to - from;
+        lock.lock();
+    }
+}
+
+int FileInput::read(uint8_t* buf, int size)
+{
+    auto start = std::chrono::steady_clock::now();
+    int64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        offset = position;
+    }
+    int64_t n = std::max<int64_t>(0, std::min<int64_t>(size, this->size - offset));
+    if (n == 0)
+        return AVERROR_EOF;
+    if (map) {
+        std::memcpy(buf, map + offset, n);
+    } else {
+        n = pread(fd, buf, n, offset);
+        if (n < 0)
+            return AVERROR(errno);
+        if (n == 0)
+            return AVERROR_EOF;
+    }
+    stats.stall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        position = offset + n;
+    }
+    moved.notify_one();
+    return (int)n;
+}
+
+int64_t FileInput::seek(int64_t offset, int whence)
+{
+    if (whence & AVSEEK_SIZE)
+        return size;
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += position;
+        break;
+    case SEEK_END:
+        offset += size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    position = offset;
+    moved.notify_one();
+    return position;
+}
+
+InputStats FileInput::get_stats()
+{
+    InputStats result = stats;
+    result.prefetched = prefetched;
+    return result;
+}
+
+std::unique_ptr<InputSource> open_input_source(const std::string& url, IoMode mode)
+{
+    if (url == "-")
+        return std::make_unique<PipeInput>(STDIN_FILENO);
+
+    // Anything with a protocol, like rtsp:// or pipe:, is left to FFmpeg.
+    std::error_code error;
+    if (mode == IoMode::Ffmpeg or url.find(':') != std::string::npos or !std::filesystem::is_regular_file(url, error))
+        return nullptr;
+    return std::make_unique<FileInput>(url, mode);
+}
@@ -0,0 +1,142 @@
+#if !defined(INPUT_SOURCE_HPP)
+#define INPUT_SOURCE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+/// @brief I/O counters of an input.
+struct InputStats {
+    uint64_t bytes = 0; // handed to the demuxer
+    uint64_t reads = 0; // read callbacks
+    uint64_t seeks = 0;
+    uint64_t stall_ns = 0; // time the demuxer waited for data
+    uint64_t prefetched = 0; // bytes asked to be read ahead
+};
+
+/// @brief How local files are read.
+enum class IoMode {
+    Mmap, // map the file, fall back to Buffered if that fails
+    Buffered, // large reads into the demuxer's buffer
+    Ffmpeg, // FFmpeg's own file protocol
+};
+
+/// @brief Where the demuxer reads the bytes from, when FFmpeg's own
+/// protocols are not good enough. Subclasses fill in read() and seek(),
+/// this class hands them to FFmpeg as a custom AVIOContext.
+class InputSource {
+private:
+    AVIOContext* ctx_io = nullptr;
+    static int read_packet(void* opaque, uint8_t* buf, int size);
+    static int64_t seek_packet(void* opaque, int64_t offset, int whence);
+
+protected:
+    InputStats stats;
+
+    /// @brief Create the AVIOContext, call it at the end of the constructor.
+    /// @param buffer_size the size of every read request from the demuxer.
+    /// @param seekable if false, seek() is never called.
+    /// @return 0 if success, else negative.
+    int open_context(int buffer_size, bool seekable);
+
+    /// @brief Read up to size bytes.
+    /// @return number of bytes read, AVERROR_EOF at the end, other negative for errors.
+    virtual int read(uint8_t* buf, int size) = 0;
+
+    /// @brief Seek like lseek, or return the total size for AVSEEK_SIZE.
+    /// @return the new position, else negative.
+    virtual int64_t seek(int64_t offset, int whence);
+
+public:
+    virtual ~InputSource();
+
+    /// @brief Check if the input was opened.
+    bool is_valid();
+
+    /// @brief Get the context to be set as AVFormatContext::pb, together
+    /// with AVFMT_FLAG_CUSTOM_IO. It is owned by this input.
+    AVIOContext* get_context();
+
+    /// @brief Get the I/O counters so far.
+    virtual InputStats get_stats();
+};
+
+/// @brief A pipe, like stdin. A background thread keeps reading into a ring
+/// buffer, so the process writing into the pipe is not held up while a
+/// frame is decoded, and memory stays constant however long the stream is.
+class PipeInput : public InputSource {
+private:
+    int fd;
+    std::vector<uint8_t> ring;
+    size_t head = 0; // next byte to hand out
+    size_t filled = 0; // bytes in the ring
+    bool ended = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread reader;
+
+    void run();
+
+protected:
+    int read(uint8_t* buf, int size) override;
+
+public:
+    /// @brief Start reading the pipe.
+    /// @param fd the file descriptor, not closed by this input.
+    /// @param read_ahead size of the ring buffer in bytes.
+    PipeInput(int fd, size_t read_ahead = 8 << 20);
+    ~PipeInput();
+};
+
+/// @brief A local file, mapped into memory or read in large chunks. The
+/// kernel is told the file is read sequentially, and a background thread
+/// asks it to keep the next few MB ahead of the read position in the page
+/// cache, so the demuxer rarely waits for the disk.
+class FileInput : public InputSource {
+private:
+    int fd = -1;
+    int64_t size = 0;
+    uint8_t* map = nullptr; // whole file, when mapped
+    int64_t position = 0;
+
+    // Read ahead
+    size_t window;
+    int64_t prefetched_from = 0, prefetched_to = 0;
+    std::atomic<uint64_t> prefetched { 0 };
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable moved;
+    std::thread prefetcher;
+
+    void run();
+
+protected:
+    int read(uint8_t* buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+
+public:
+    /// @brief Open a file.
+    /// @param path the local file.
+    /// @param mode Mmap or Buffered.
+    /// @param window bytes to keep ahead of the read position.
+    FileInput(const std::string& path, IoMode mode = IoMode::Mmap, size_t window = 16 << 20);
+    ~FileInput();
+
+    InputStats get_stats() override;
+};
+
+/// @brief Open a custom input for the url, if there is one for it: `-` is
+/// stdin, local files are read with the given mode.
+/// @return the input, or nullptr if FFmpeg should open the url itself.
+std::unique_ptr<InputSource> open_input_source(const std::string& url, IoMode mode = IoMode::Mmap);
+#endif // INPUT_SOURCE_HPP
@@ -0,0 +1,97 @@
+#if !defined(LATEST_FRAME_HPP)
+#define LATEST_FRAME_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+
+#include "metrics.hpp"
+
+/// @brief A single slot handing the newest frame to a slow consumer, like a
+/// preview window. The producer never waits: a frame that is not taken in
+/// time is replaced by the next one. The consumer sets the pace, the slot
+/// only asks for a frame once per interval.
+template <typename T>
+class LatestFrame {
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::duration interval;
+    std::atomic<Clock::rep> due { 0 }; // when the consumer wants the next frame
+
+    std::mutex mutex;
+    std::condition_variable offered;
+    T slot;
+    bool full = false;
+    bool closed = false;
+
+public:
+    /// @brief Create a slot.
+    /// @param max_fps max number of frames taken per second, 0 for no limit.
+    explicit LatestFrame(double max_fps)
+        : interval(max_fps > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / max_fps)) : Clock::duration::zero())
+    {
+    }
+
+    /// @brief Check if the consumer is ready for a frame, without locking.
+    /// Producers skip the work of making a frame nobody will see.
+    bool wanted()
+    {
+        return Clock::now().time_since_epoch().count() >= due.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Put a frame in the slot, never waiting. A frame not taken yet
+    /// is replaced, and counted as dropped.
+    /// @return false if a frame was replaced.
+    bool offer(T&& item)
+    {
+        bool replaced;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed)
+                return true;
+            replaced = full;
+            slot = std::move(item);
+            full = true;
+        }
+        if (replaced)
+            METRICS_COUNT(Counter::PreviewDropped, 1);
+        offered.notify_one();
+        return !replaced;
+    }
+
+    /// @brief Take the frame in the slot, waiting for one at most timeout.
+    /// @return true if a frame was taken.
+    template <typename Rep, typename Period>
+    bool take(T& item, std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!offered.wait_for(lock, timeout, [this] { return full or closed; }) or !full)
+            return false;
+        item = std::move(slot);
+        full = false;
+        due.store((Clock::now() + interval).time_since_epoch().count(), std::memory_order_relaxed);
+        return true;
+    }
+
+    /// @brief Check if the slot is closed and the last frame taken.
+    bool finished()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed and !full;
+    }
+
+    /// @brief Mark the end of the stream. The frame in the slot can still be
+    /// taken, and no more are wanted.
+    void close()
+    {
+        due.store(std::numeric_limits<Clock::rep>::max(), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        offered.notify_all();
+    }
+};
+#endif // LATEST_FRAME_HPP
@@ -2,78 +2,1001 @@
 // FFMPEG.
 // For more: https://github.com/yinguobing/make-it-glitch
 
+#include <atomic>
+#include <fstream>
+#include <glob.h>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "bounded_queue.hpp"
+#include "dataset.hpp"
+#include "exporter.hpp"
+#include "frame_scorer.hpp"
+#include "glitch_effects.hpp"
+#include "glitch_remuxer.hpp"
+#include "latest_frame.hpp"
+#include "metrics.hpp"
+#include "run_log.hpp"
+#include "stream_writer.hpp"
+#include "thread_pool.hpp"
 #include "video_decoder.hpp"
 
-// @brief Center crop the image after resizing
-cv::Mat center_crop_after_resize(cv::Mat& image, int width, int height)
+// Sizes to export, separated by commas. A size is `WxH` or `native`, with an
+// optional crop mode (`center` by default, or `stretch`) and image format,
+// like `640x640:stretch:png`. With several sizes, every size gets its own
+// folder, named after it.
+static bool parse_levels(const std::string& list, ImageFormat format, std::vector<ExportLevel>& levels)
 {
-    int w = image.cols, h = image.rows;
-    float scale = std::max(height / (float)h, width / (float)w);
-    cv::Mat out;
-    cv::resize(image, out, cv::Size(0, 0), scale, scale);
-    int _h = out.rows, _w = out.cols;
-    int x = 0, y = 0;
-    if (_h < _w)
-        x += int((_w - width) / 2);
-    else
-        y += int((_h - height) / 2);
-    cv::Rect roi { x, y, width, height };
-    out = out(roi);
-    return out;
+    std::stringstream sizes { list };
+    std::string size;
+    while (std::getline(sizes, size, ',')) {
+        std::stringstream fields { size };
+        std::string field;
+        ExportLevel level;
+        level.format = format;
+        std::getline(fields, field, ':');
+        if (field == "native") {
+            level.geometry.width = level.geometry.height = 0;
+        } else if (std::sscanf(field.c_str(), "%dx%d", &level.geometry.width, &level.geometry.height) != 2
+            or level.geometry.width <= 0 or level.geometry.height <= 0) {
+            return false;
+        }
+        level.name = field;
+        while (std::getline(fields, field, ':')) {
+            if (field == "center")
+                level.geometry.crop = CropMode::Center;
+            else if (field == "stretch")
+                level.geometry.crop = CropMode::Stretch;
+            else if (field == "jpeg" or field == "jpg")
+                level.format = ImageFormat::Jpeg;
+            else if (field == "png")
+                level.format = ImageFormat::Png;
+            else if (field == "webp")
+                level.format = ImageFormat::Webp;
+            else
+                return false;
+        }
+        if (level.geometry.crop == CropMode::Stretch)
+            level.name += "-stretch";
+        levels.push_back(level);
+    }
+    if (levels.size() == 1)
+        levels[0].name.clear();
+    return !levels.empty();
 }
 
-int main(int argc, char** argv)
+// Frame numbers separated by commas, and ranges like `100-200`.
+static bool parse_frames(const std::string& list, std::vector<int>& frames)
 {
-    // Safety check, always!
-    if (argc != 3 and argc != 4) {
-        std::cout << "Usage:\n    "
-                  << argv[0] << " <your-video-file> <export-dir> [no-touching]\n"
-                  << "More than 4 args will trigger the exporting without any glitch(the original frame)."
-                  << std::endl;
-        exit(1);
+    std::stringstream numbers { list };
+    std::string item;
+    while (std::getline(numbers, item, ',')) {
+        int first, last;
+        char dash;
+        std::stringstream range { item };
+        if (!(range >> first) or first < 1)
+            return false;
+        last = first;
+        if (range >> dash and (dash != '-' or !(range >> last) or last < first))
+            return false;
+        for (int n = first; n <= last; n++)
+            frames.push_back(n);
+    }
+    std::sort(frames.begin(), frames.end());
+    return !frames.empty();
+}
+
+// FFmpeg flag names separated by commas, like `careful,bitstream`, or
+// `none` for no flags.
+static bool parse_flags(const std::string& list, const std::vector<std::pair<const char*, int>>& names, int& flags)
+{
+    flags = 0;
+    if (list == "none")
+        return true;
+    std::stringstream items { list };
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        auto found = std::find_if(names.begin(), names.end(), [&](auto& name) { return item == name.first; });
+        if (found == names.end())
+            return false;
+        flags |= found->second;
+    }
+    return true;
+}
+
+// Pixel effects separated by commas, applied in order. An effect is its
+// name with an optional amount and strength, like `rows:0.3:32`; an empty
+// field keeps the default, like `quantize::2`.
+static bool parse_effects(const std::string& list, std::vector<Effect>& effects)
+{
+    static const std::pair<const char*, EffectType> names[] = {
+        { "channel", EffectType::ChannelShift },
+        { "rows", EffectType::RowShift },
+        { "blocks", EffectType::BlockShift },
+        { "tear", EffectType::ScanlineTear },
+        { "sort", EffectType::PixelSort },
+        { "quantize", EffectType::Quantize },
+    };
+    std::stringstream items { list };
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        std::stringstream fields { item };
+        std::string name, amount, strength;
+        std::getline(fields, name, ':');
+        std::getline(fields, amount, ':');
+        std::getline(fields, strength, ':');
+        auto found = std::find_if(std::begin(names), std::end(names), [&](auto& entry) { return name == entry.first; });
+        if (found == std::end(names))
+            return false;
+        Effect effect = default_effect(found->second);
+        try {
+            if (!amount.empty())
+                effect.amount = std::stof(amount);
+            if (!strength.empty())
+                effect.strength = std::stoi(strength);
+        } catch (const std::exception&) {
+            return false;
+        }
+        effects.push_back(effect);
+    }
+    return !effects.empty();
+}
+
+// Command line options. Flags start with `--`, the rest are positional.
+struct Options {
+    std::vector<std::string> positional;
+    bool remux = false;
+    bool stream = false; // raw frames to stdout
+    StreamFormat stream_format = StreamFormat::Y4m;
+    bool touch = true;
+    bool seeded = false;
+    CorruptionOptions corruption;
+    ErrorPolicy errors;
+    DecodeQuality quality = DecodeQuality::Preview;
+    IoMode io = IoMode::Mmap;
+    bool fast_open = false;
+    bool resume = false; // carry on from the run logs in the export dir
+    double checkpoint_interval = 10;
+    int chunks = 1;
+    bool batch = false;
+    int jobs = 0;
+    size_t max_memory = 0;
+    std::string stats_path;
+    std::string prometheus_path;
+    int prometheus_interval = 10;
+    bool dataset = false; // one indexed file instead of an image per frame
+    DatasetEncoding dataset_encoding = DatasetEncoding::Raw;
+    EncoderSettings encoder;
+    int encoders = 0; // threads encoding images, 0 for half of the cores
+    ImageSink* sink = nullptr; // where the exported images go
+    double preview_fps = 30;
+    std::string sizes = "320x320"; // see parse_levels()
+    FrameSelection selection = FrameSelection::every_nth(150);
+    bool every_given = false;
+    ScoreOptions score; // pick the glitchy frames among the selected ones
+    std::vector<ExportLevel> levels;
+    std::vector<Effect> effects; // see parse_effects()
+};
+
+// A frame travelling through the pipeline stages.
+struct Job {
+    int index = 0;
+    int64_t pts = AV_NOPTS_VALUE; // every frame up to it is done with this one, for checkpoints
+    FramePtr frame; // decoded, native pixel format
+    std::vector<cv::Mat> images; // BGR, one per export level
+    bool shown = false; // wanted by the preview
+    bool preview_only = false; // not selected, only decoded on the way
+};
+
+static void print_usage(const char* name)
+{
+    std::cout << "Usage:\n    "
+              << name << " <your-video-file> <export-dir> [no-touching]\n    "
+              << name << " --remux <your-video-file> <output-video-file> [no-touching]\n    "
+              << name << " --batch <video-dir|glob|manifest> <export-dir> [no-touching]\n    "
+              << name << " [--format y4m|bgr|yuv] <your-video-file|-> - [no-touching]\n"
+              << "More than 4 args will trigger the exporting without any glitch(the original frame).\n"
+              << "With --remux the glitched video is written without decoding.\n"
+              << "With `-` as the export dir, every frame is written to stdout, and `-` as the video reads stdin.\n"
+              << "Options:\n"
+              << "    --seed <n>            seed of the corruption, random by default\n"
+              << "    --probability <p>     chance for a packet to be touched, 1.0 by default\n"
+              << "    --bit-flip            flip bits instead of overwriting bytes\n"
+              << "    --err-recognition <f> errors the decoder looks for, like careful,bitstream, or none\n"
+              << "    --concealment <f>     how broken blocks are hidden, like guess_mvs,deblock, or none\n"
+              << "    --frame-budget <ms>   skip the rest of a GOP taking longer for a frame, no limit by default\n"
+              << "    --max-failure-rate <r> share of packets the decoder may reject, any by default\n"
+              << "    --on-failure <a>      lower the corruption or skip the GOP past that rate, lower by default\n"
+              << "    --full-quality        decode every pixel, even for the small thumbnails\n"
+              << "    --io <mode>           read local files with mmap, buffered or ffmpeg, mmap by default\n"
+              << "    --format <f>          y4m, bgr (raw bgr24) or yuv (raw yuv420p) for stdout, y4m by default\n"
+              << "    --preview-fps <n>     max frame rate of the preview window, 0 for no limit, 30 by default\n"
+              << "    --fast-open           probe only the header of MP4 and Matroska files\n"
+              << "    --resume              carry on from the last checkpoint with the same glitches\n"
+              << "    --checkpoint-interval <s> seconds between checkpoints of a resumable run, 10 by default\n"
+              << "    --chunks <n>          decode n GOP aligned chunks in parallel, 0 for all cores\n"
+              << "    --jobs <n>            videos decoded at the same time in batch mode, all cores by default\n"
+              << "    --max-memory <MB>     memory for the running decoders in batch mode, half the RAM by default\n"
+              << "    --start <s>           skip the frames before this many seconds\n"
+              << "    --end <s>             stop at this many seconds\n"
+              << "    --frames <list>       only these frame numbers, like 1,50,100-200\n"
+              << "    --every <n>           every n-th frame, 150 by default unless --frames or --rate is given\n"
+              << "    --rate <fps>          at most this many frames per second of video\n"
+              << "    --min-score <s>       only frames this glitchy, from 0 to 1, every selected frame is a candidate\n"
+              << "    --top <k>             only the k glitchiest frames of every window\n"
+              << "    --score-window <n>    frames of a --top window, 150 by default\n"
+              << "    --effects <list>      pixel effects on the exported frames, like channel,rows:0.3:32,quantize::2\n"
+              << "    --sizes <list>        sizes to export, like 640x640,320x320:stretch,native:png, 320x320 by default\n"
+              << "    --image-format <f>    jpeg, png or webp, jpeg by default\n"
+              << "    --quality <q>         JPEG and WebP quality from 1 to 100, 95 by default\n"
+              << "    --subsampling <s>     JPEG chroma subsampling 444, 422 or 420, 420 by default\n"
+              << "    --fast-dct            faster and slightly less accurate JPEG encoding\n"
+              << "    --png-compression <n> PNG compression from 0 to 9, 3 by default\n"
+              << "    --encoders <n>        threads encoding the images, half of the cores by default\n"
+              << "    --dataset raw|jpeg    append the crops to an indexed dataset in the export dir\n"
+              << "    --stats <file>        write stage timings and counters as JSON at exit\n"
+              << "    --prometheus <file>   keep a Prometheus text file of the same metrics up to date\n"
+              << "    --prometheus-interval <s>  seconds between updates of the Prometheus file, 10 by default"
+              << std::endl;
+}
+
+static bool parse_args(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg { argv[i] };
+        bool has_value = i + 1 < argc;
+        // Numbers that cannot be parsed print the usage, like any other
+        // invalid value.
+        try {
+            if (arg == "--remux") {
+                options.remux = true;
+            } else if (arg == "--seed" and has_value) {
+                options.corruption.seed = std::stoull(argv[++i]);
+                options.seeded = true;
+            } else if (arg == "--probability" and has_value) {
+                options.corruption.probability = std::stod(argv[++i]);
+                if (!(options.corruption.probability >= 0 and options.corruption.probability <= 1)) {
+                    std::cerr << "The probability must be between 0 and 1." << std::endl;
+                    return false;
+                }
+            } else if (arg == "--bit-flip") {
+                options.corruption.mode = CorruptionMode::BitFlip;
+            } else if (arg == "--format" and has_value) {
+                std::string format { argv[++i] };
+                if (format == "y4m")
+                    options.stream_format = StreamFormat::Y4m;
+                else if (format == "bgr")
+                    options.stream_format = StreamFormat::RawBgr;
+                else if (format == "yuv")
+                    options.stream_format = StreamFormat::RawYuv;
+                else
+                    return false;
+            } else if (arg == "--io" and has_value) {
+                std::string io { argv[++i] };
+                if (io == "mmap")
+                    options.io = IoMode::Mmap;
+                else if (io == "buffered")
+                    options.io = IoMode::Buffered;
+                else if (io == "ffmpeg")
+                    options.io = IoMode::Ffmpeg;
+                else
+                    return false;
+            } else if (arg == "--dataset" and has_value) {
+                std::string encoding { argv[++i] };
+                if (encoding == "raw")
+                    options.dataset_encoding = DatasetEncoding::Raw;
+                else if (encoding == "jpeg")
+                    options.dataset_encoding = DatasetEncoding::Jpeg;
+                else
+                    return false;
+                options.dataset = true;
+            } else if (arg == "--image-format" and has_value) {
+                std::string format { argv[++i] };
+                if (format == "jpeg" or format == "jpg")
+                    options.encoder.format = ImageFormat::Jpeg;
+                else if (format == "png")
+                    options.encoder.format = ImageFormat::Png;
+                else if (format == "webp")
+                    options.encoder.format = ImageFormat::Webp;
+                else
+                    return false;
+            } else if (arg == "--quality" and has_value) {
+                options.encoder.quality = std::clamp(std::stoi(argv[++i]), 1, 100);
+            } else if (arg == "--subsampling" and has_value) {
+                std::string subsampling { argv[++i] };
+                if (subsampling == "444")
+                    options.encoder.subsampling = ChromaSubsampling::S444;
+                else if (subsampling == "422")
+                    options.encoder.subsampling = ChromaSubsampling::S422;
+                else if (subsampling == "420")
+                    options.encoder.subsampling = ChromaSubsampling::S420;
+                else
+                    return false;
+            } else if (arg == "--fast-dct") {
+                options.encoder.fast_dct = true;
+            } else if (arg == "--png-compression" and has_value) {
+                options.encoder.png_compression = std::clamp(std::stoi(argv[++i]), 0, 9);
+            } else if (arg == "--encoders" and has_value) {
+                options.encoders = std::max(0, std::stoi(argv[++i]));
+            } else if (arg == "--start" and has_value) {
+                options.selection.start = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--end" and has_value) {
+                options.selection.end = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--frames" and has_value) {
+                if (!parse_frames(argv[++i], options.selection.frames))
+                    return false;
+            } else if (arg == "--every" and has_value) {
+                options.selection.every = std::max(1, std::stoi(argv[++i]));
+                options.every_given = true;
+            } else if (arg == "--rate" and has_value) {
+                options.selection.rate = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--min-score" and has_value) {
+                options.score.threshold = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--top" and has_value) {
+                options.score.top = std::max(0, std::stoi(argv[++i]));
+            } else if (arg == "--score-window" and has_value) {
+                options.score.window = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--effects" and has_value) {
+                if (!parse_effects(argv[++i], options.effects)) {
+                    std::cerr << "Invalid effects: " << argv[i] << std::endl;
+                    return false;
+                }
+            } else if (arg == "--sizes" and has_value) {
+                options.sizes = argv[++i];
+            } else if (arg == "--preview-fps" and has_value) {
+                options.preview_fps = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--err-recognition" and has_value) {
+                static const std::vector<std::pair<const char*, int>> names {
+                    { "crccheck", AV_EF_CRCCHECK }, { "bitstream", AV_EF_BITSTREAM }, { "buffer", AV_EF_BUFFER },
+                    { "explode", AV_EF_EXPLODE }, { "ignore_err", AV_EF_IGNORE_ERR }, { "careful", AV_EF_CAREFUL },
+                    { "compliant", AV_EF_COMPLIANT }, { "aggressive", AV_EF_AGGRESSIVE }
+                };
+                if (!parse_flags(argv[++i], names, options.errors.recognition)) {
+                    std::cerr << "Invalid error recognition: " << argv[i] << std::endl;
+                    return false;
+                }
+            } else if (arg == "--concealment" and has_value) {
+                static const std::vector<std::pair<const char*, int>> names {
+                    { "guess_mvs", FF_EC_GUESS_MVS }, { "deblock", FF_EC_DEBLOCK }, { "favor_inter", FF_EC_FAVOR_INTER }
+                };
+                if (!parse_flags(argv[++i], names, options.errors.concealment)) {
+                    std::cerr << "Invalid concealment: " << argv[i] << std::endl;
+                    return false;
+                }
+            } else if (arg == "--frame-budget" and has_value) {
+                options.errors.frame_budget = std::max(0.0, std::stod(argv[++i]) / 1000);
+            } else if (arg == "--max-failure-rate" and has_value) {
+                options.errors.max_failure_rate = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--on-failure" and has_value) {
+                std::string action = argv[++i];
+                if (action == "lower")
+                    options.errors.action = FailureAction::LowerCorruption;
+                else if (action == "skip")
+                    options.errors.action = FailureAction::SkipGop;
+                else
+                    return false;
+            } else if (arg == "--full-quality") {
+                options.quality = DecodeQuality::Full;
+            } else if (arg == "--fast-open") {
+                options.fast_open = true;
+            } else if (arg == "--resume") {
+                options.resume = true;
+            } else if (arg == "--checkpoint-interval" and has_value) {
+                options.checkpoint_interval = std::max(0.0, std::stod(argv[++i]));
+            } else if (arg == "--chunks" and has_value) {
+                options.chunks = std::stoi(argv[++i]);
+                if (options.chunks <= 0)
+                    options.chunks = std::max(1u, std::thread::hardware_concurrency());
+            } else if (arg == "--batch") {
+                options.batch = true;
+            } else if (arg == "--jobs" and has_value) {
+                options.jobs = std::max(0, std::stoi(argv[++i]));
+            } else if (arg == "--max-memory" and has_value) {
+                options.max_memory = std::stoull(argv[++i]) << 20;
+            } else if (arg == "--stats" and has_value) {
+                options.stats_path = argv[++i];
+            } else if (arg == "--prometheus" and has_value) {
+                options.prometheus_path = argv[++i];
+            } else if (arg == "--prometheus-interval" and has_value) {
+                options.prometheus_interval = std::max(1, std::stoi(argv[++i]));
+            } else if (arg.rfind("--", 0) == 0) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            } else {
+                options.positional.push_back(arg);
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value of " << arg << ": " << argv[i] << std::endl;
+            return false;
+        }
+    }
+    if (options.positional.size() != 2 and options.positional.size() != 3)
+        return false;
+
+    // Stdout carries the frames, everything else goes to stderr.
+    options.stream = options.positional[1] == "-" and !options.remux and !options.batch;
+    if (options.stream)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    // Every 150th frame is only the default of a plain image export. Frame
+    // lists and rates pick the frames themselves, a stream carries every
+    // frame and scoring considers every frame, unless --every says otherwise.
+    bool picked = !options.selection.frames.empty() or options.selection.rate > 0;
+    if (!options.every_given and (picked or options.stream or options.score.enabled()))
+        options.selection.every = 1;
+    if (!parse_levels(options.sizes, options.encoder.format, options.levels)) {
+        std::cerr << "Invalid sizes: " << options.sizes << std::endl;
+        return false;
+    }
+    options.touch = options.positional.size() == 2;
+    if (options.positional[0] == "-")
+        options.chunks = 1;
+    if (options.max_memory == 0)
+        options.max_memory = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 2;
+
+    // Print the seed so that any run can be reproduced. The pixel effects
+    // draw from it too. A resumed run takes the seed of its log, printed
+    // once the log is open.
+    if (!options.seeded) {
+        std::random_device rd;
+        options.corruption.seed = ((uint64_t)rd() << 32) | rd();
+    }
+    if (options.touch or !options.effects.empty()) {
+        if (!options.resume)
+            std::cout << "Corruption seed: " << options.corruption.seed << std::endl;
+        else if (options.batch or options.chunks > 1)
+            std::cout << "Corruption seed of new logs: " << options.corruption.seed << std::endl;
+    }
+    return true;
+}
+
+// Write a glitched copy of the video, in the compressed domain.
+static int run_remux(const Options& options)
+{
+    GlitchRemuxer remuxer { options.positional[0], options.positional[1], options.corruption };
+    if (!remuxer.is_valid())
+        return 1;
+    return remuxer.run(options.touch) < 0 ? 1 : 0;
+}
+
+// Make the folders of every size, a dataset needs none.
+static void create_export_dirs(const Options& options, const std::filesystem::path& export_dir)
+{
+    if (options.dataset)
+        return;
+    for (auto&& level : options.levels)
+        std::filesystem::create_directories(export_dir / level.name);
+}
+
+static ExportSettings export_settings(const Options& options, int decoders)
+{
+    ExportSettings settings;
+    settings.export_dir = options.positional[1];
+    settings.levels = options.levels;
+    settings.selection = options.selection;
+    settings.score = options.score;
+    settings.touch = options.touch;
+    settings.effects = options.effects;
+    settings.effects_seed = options.corruption.seed;
+    settings.decoder.corruption = options.corruption;
+    settings.decoder.errors = options.errors;
+    settings.decoder.output = largest_geometry(options.levels);
+    settings.decoder.quality = options.quality;
+    settings.decoder.io = options.io;
+    settings.decoder.fast_open = options.fast_open;
+    settings.resume = options.resume;
+    settings.checkpoint_interval = options.checkpoint_interval;
+    settings.sink = options.sink;
+
+    // Share the cores between the decoders running at the same time.
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    settings.decoder.threads = std::max(1, cores / std::max(1, decoders));
+    return settings;
+}
+
+// Split the video into GOP aligned chunks with about the same number of
+// frames, and decode them on separate threads. Every chunk has its own
+// decoder and corruption engine, seeded the same, so the packets are touched
+// exactly as in a sequential run.
+static int run_chunked_export(const Options& options)
+{
+    ExportSettings settings = export_settings(options, options.chunks);
+    create_export_dirs(options, settings.export_dir);
+    std::cout << "Glitchy images will be saved in " << settings.export_dir.string() << std::endl;
+
+    // Where are the keyframes?
+    VideoIndex index;
+    {
+        VideoDecoder indexer { options.positional[0] };
+        if (!indexer.is_valid())
+            return 1;
+        index = indexer.build_index();
+    }
+    if (index.frames.empty() or index.keyframes.empty()) {
+        std::cerr << "Cannot index the video stream." << std::endl;
+        return 1;
+    }
+    std::vector<int64_t> starts = split_chunks(index, options.chunks);
+    std::cout << "Frames: " << index.frames.size() << ", chunks: " << starts.size() << std::endl;
+
+    std::vector<std::thread> workers;
+    std::atomic<bool> failed { false };
+    for (size_t i = 0; i < starts.size(); i++) {
+        int64_t start = starts[i];
+        int64_t end = i + 1 < starts.size() ? starts[i + 1] : INT64_MAX;
+        workers.emplace_back([&, start, end] {
+            if (export_range(options.positional[0], settings, &index, start, end) < 0)
+                failed = true;
+        });
+    }
+    for (auto&& worker : workers)
+        worker.join();
+
+    return failed ? 1 : 0;
+}
+
+// Find the videos of a batch: every video in a directory, the files matching
+// a glob pattern, or the files listed in a manifest, one per line.
+static std::vector<std::filesystem::path> collect_inputs(const std::string& source)
+{
+    std::vector<std::filesystem::path> inputs;
+    std::filesystem::path path { source };
+    if (std::filesystem::is_directory(path)) {
+        const std::set<std::string> extensions { ".mp4", ".mkv", ".mov", ".avi", ".webm", ".flv", ".ts", ".m4v", ".mpg", ".mpeg", ".wmv", ".3gp" };
+        for (auto&& entry : std::filesystem::recursive_directory_iterator(path)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() and extensions.count(extension))
+                inputs.push_back(entry.path());
+        }
+    } else if (source.find_first_of("*?[") != std::string::npos) {
+        glob_t matches;
+        if (glob(source.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+                inputs.emplace_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+    } else {
+        std::ifstream manifest { path };
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (!line.empty() and line[0] != '#')
+                inputs.emplace_back(line);
+        }
+    }
+    return inputs;
+}
+
+// Export many videos in one process. Every video is a task of a work
+// stealing pool, and a video much larger than its fair share splits itself
+// into GOP aligned chunks that idle workers can steal.
+static int run_batch(const Options& options)
+{
+    std::vector<std::filesystem::path> inputs = collect_inputs(options.positional[0]);
+    if (inputs.empty()) {
+        std::cerr << "No video found in: " << options.positional[0] << std::endl;
+        return 1;
+    }
+
+    // Small ones first: workers take their newest task, so the large videos
+    // start early and thieves pick up the short clips.
+    std::vector<std::pair<uintmax_t, std::filesystem::path>> videos;
+    uintmax_t total_size = 0;
+    for (auto&& input : inputs) {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(input, error);
+        if (error)
+            size = 0;
+        videos.emplace_back(size, input);
+        total_size += size;
     }
+    std::sort(videos.begin(), videos.end());
 
+    // Clips with the same codec parameters reuse the decoders opened for
+    // earlier ones.
+    DecoderPool contexts { std::max(1u, std::thread::hardware_concurrency()) * 2 };
+    ThreadPool pool { (size_t)options.jobs };
+    ResourceBudget memory { options.max_memory };
+    ExportSettings base = export_settings(options, pool.size());
+    base.memory = &memory;
+    base.decoder.contexts = &contexts;
+    uintmax_t fair_share = total_size / pool.size() + 1;
+    std::cout << "Videos: " << videos.size() << ", workers: " << pool.size() << std::endl;
+
+    // Every video gets its own folder, named after the file.
+    std::set<std::string> folders;
+    std::atomic<bool> failed { false };
+    for (auto&& [size, video] : videos) {
+        std::string folder = video.stem().string();
+        for (int n = 2; folders.count(folder); n++)
+            folder = video.stem().string() + "-" + std::to_string(n);
+        folders.insert(folder);
+
+        ExportSettings settings = base;
+        settings.export_dir = base.export_dir / folder;
+        uintmax_t video_size = size;
+        std::string url = video.string();
+        pool.submit([&pool, &options, &failed, settings, video_size, fair_share, url] {
+            create_export_dirs(options, settings.export_dir);
+            if (video_size <= fair_share or pool.size() == 1) {
+                int exported = export_range(url, settings);
+                if (exported < 0) {
+                    std::cerr << "Cannot export: " << url << std::endl;
+                    failed = true;
+                    return;
+                }
+                std::cout << "Exported " << exported << " images from " << url << std::endl;
+                return;
+            }
+            auto index = std::make_shared<VideoIndex>();
+            {
+                VideoDecoder indexer { url };
+                if (!indexer.is_valid()) {
+                    std::cerr << "Cannot export: " << url << std::endl;
+                    failed = true;
+                    return;
+                }
+                *index = indexer.build_index();
+            }
+            std::vector<int64_t> starts = split_chunks(*index, (int)(video_size * 2 / fair_share) + 1);
+            for (size_t i = 0; i < starts.size(); i++) {
+                int64_t start = starts[i];
+                int64_t end = i + 1 < starts.size() ? starts[i + 1] : INT64_MAX;
+                pool.submit([&failed, settings, url, index, start, end] {
+                    if (export_range(url, settings, index.get(), start, end) < 0)
+                        failed = true;
+                });
+            }
+            std::cout << "Split " << url << " into " << starts.size() << " chunks" << std::endl;
+        });
+    }
+    pool.wait();
+
+    return failed ? 1 : 0;
+}
+
+// Decode the video and write every glitchy frame to stdout, for shell
+// pipelines. Nothing touches the disk.
+static int run_stream(const Options& options)
+{
+    DecoderOptions decoder_options;
+    decoder_options.corruption = options.corruption;
+    decoder_options.errors = options.errors;
+    decoder_options.io = options.io;
+    decoder_options.fast_open = options.fast_open;
+    VideoDecoder decoder { options.positional[0], AV_HWDEVICE_TYPE_CUDA, decoder_options };
+    if (!decoder.is_valid())
+        return 1;
+    VideoIndex index;
+    bool indexed = !options.selection.frames.empty() and options.positional[0] != "-";
+    if (indexed)
+        index = decoder.build_index();
+    if (decoder.select(options.selection, indexed ? &index : nullptr) < 0)
+        return 1;
+
+    // Writing to the pipe runs next to the decoding.
+    const size_t queue_size = 8;
+    BoundedQueue<FramePtr> decoded { queue_size };
+    std::atomic<bool> failed { false };
+    std::thread write_stage([&] {
+        StreamWriter writer { stdout, options.stream_format, decoder.get_frame_rate() };
+        FramePtr frame;
+        while (decoded.pop(frame)) {
+            if (!failed and writer.write(frame.get()) < 0) {
+                std::cerr << "Cannot write to stdout." << std::endl;
+                failed = true;
+            }
+        }
+    });
+
+    FramePtr frame;
+    while (!failed and decoder.grab_selected(options.touch) == 0) {
+        if (decoder.retrieve(frame) < 0)
+            continue;
+        decoded.push(std::move(frame));
+    }
+    decoded.close();
+    write_stage.join();
+    return failed ? 1 : 0;
+}
+
+// Decode the video and export the glitchy frames as images.
+static int run_export(const Options& options)
+{
     // Create directories for exporting images.
-    std::filesystem::path video_file { argv[1] };
-    std::filesystem::path export_dir { argv[2] };
-    std::filesystem::create_directories(export_dir);
+    std::filesystem::path video_file { options.positional[0] };
+    std::filesystem::path export_dir { options.positional[1] };
+    create_export_dirs(options, export_dir);
     std::cout << "Glitchy images will be saved in " << export_dir.string() << std::endl;
 
-    // Init the decoder
-    char* filename = argv[1];
-    VideoDecoder decoder { std::string(filename), AV_HWDEVICE_TYPE_CUDA };
+    // Init the decoder. Small sizes are fine with preview quality.
+    DecoderOptions decoder_options;
+    decoder_options.corruption = options.corruption;
+    decoder_options.errors = options.errors;
+    decoder_options.output = largest_geometry(options.levels);
+    decoder_options.quality = options.quality;
+    decoder_options.io = options.io;
+    decoder_options.fast_open = options.fast_open;
+
+    // A resumed run starts after the checkpoint, with the corruption of the
+    // run that wrote the log.
+    std::unique_ptr<RunLog> log;
+    int64_t start = INT64_MIN;
+    if (options.resume) {
+        log = std::make_unique<RunLog>(run_log_path(export_dir), decoder_options.corruption, true);
+        if (!log->is_valid())
+            return 1;
+        if (log->is_finished()) {
+            std::cout << "Already exported, nothing to resume." << std::endl;
+            return 0;
+        }
+        RunLog::Checkpoint checkpoint = log->get_checkpoint();
+        if (checkpoint.pts != AV_NOPTS_VALUE)
+            start = checkpoint.pts + 1;
+        decoder_options.log = log.get();
+        if (options.touch or !options.effects.empty())
+            std::cout << "Corruption seed: " << decoder_options.corruption.seed << std::endl;
+    }
+    VideoDecoder decoder { options.positional[0], AV_HWDEVICE_TYPE_CUDA, decoder_options };
 
     // Check if the decoder is valid
     std::cout << "Supported accelerator: ";
     for (auto&& acc : decoder.list_hw_accelerators())
         std::cout << acc << " " << std::endl;
     std::cout << "Valid: " << decoder.is_valid() << std::endl;
+    if (!decoder.is_valid())
+        return 1;
     std::cout << "Accelerated: " << decoder.is_accelerated() << std::endl;
-
-    // Prepare memory space for frames
-    uint8_t* buffer = decoder.get_buffer();
     auto [width, height] = decoder.get_frame_dims();
     std::cout << "Width: " << width << " height: " << height << std::endl;
-    cv::Mat bgr(height, width, CV_8UC3, buffer, decoder.get_frame_steps());
-
-    // Loop the video stream for frames. Press `ESC` to stop.
-    int ret = 0, frame_count = 0, frame_skip = 150;
-    bool will_be_touched = argc == 3;
-    while (ret == 0 or ret == AVERROR(EAGAIN)) {
-        frame_count++;
-        ret = decoder.read(will_be_touched);
-        cv::Mat dump = center_crop_after_resize(bgr, 320, 320);
-        if (frame_count % frame_skip == 0) {
-            std::string filename = video_file.stem().string().append("-").append(std::to_string(frame_count)).append(".jpg");
-            auto img_path = export_dir / std::filesystem::path { filename };
-            cv::imwrite(img_path.string(), dump);
+
+    // Index the stream to skip the GOPs without any selected frame, and to
+    // number the frames by their place in it, as the chunks do. Packets the
+    // corruption makes the decoder reject shift no frame number. Pipes can
+    // only be read once.
+    VideoIndex index;
+    bool indexed = options.positional[0] != "-";
+    if (indexed)
+        index = decoder.build_index();
+    int selected = decoder.select(options.selection, indexed ? &index : nullptr, start);
+    if (selected < 0)
+        return 1;
+    if (indexed)
+        std::cout << "Frames: " << index.frames.size() << ", selected: " << selected << std::endl;
+
+    // Every stage runs on its own thread. The queues between them are short,
+    // so a slow stage holds back the ones before it instead of piling up frames.
+    const size_t queue_size = 8;
+    BoundedQueue<Job> decoded { queue_size }, converted { queue_size };
+#ifdef WITH_GUI
+    // The preview only ever gets the newest frame, it never holds back the
+    // pipeline. Frames decoded but not selected feed it too, one at a time.
+    LatestFrame<cv::Mat> preview { options.preview_fps };
+    std::atomic<bool> preview_queued { false };
+#endif
+    std::atomic<bool> stop { false };
+    std::atomic<bool> reached_end { false };
+    std::atomic<bool> written { true };
+    bool will_be_touched = options.touch;
+
+    // Stage 1: demux and decode. Only the GOPs holding selected frames are
+    // decoded, and the other frames in them cost only their decode. Scored
+    // frames are picked here, so the others are never converted.
+    std::thread decode_stage([&] {
+        FrameScorer scorer;
+        FramePicker picker { options.score };
+        std::vector<ScoredFrame> picked;
+        auto push_picked = [&] {
+            bool pushed = true;
+            for (auto&& scored : picked) {
+                Job job;
+                job.index = scored.frame_number;
+                // Only the last one settles the frames before it.
+                job.pts = &scored == &picked.back() ? picker.settled().pts : AV_NOPTS_VALUE;
+                job.frame = std::move(scored.frame);
+#ifdef WITH_GUI
+                job.shown = preview.wanted();
+#endif
+                if (pushed)
+                    pushed = decoded.push(std::move(job));
+            }
+            picked.clear();
+            return pushed;
+        };
+
+        FramePtr frame;
+        std::function<void()> passed;
+#ifdef WITH_GUI
+        passed = [&] {
+            if (preview_queued or !preview.wanted() or decoder.retrieve(frame) < 0)
+                return;
+            Job job;
+            job.index = decoder.get_frame_number();
+            job.frame = std::move(frame);
+            job.shown = true;
+            job.preview_only = true;
+            preview_queued = true;
+            decoded.push(std::move(job));
+        };
+#endif
+        int ret = 0;
+        while (!stop and (ret = decoder.grab_selected(will_be_touched, passed)) == 0) {
+            if (options.score.enabled()) {
+                ScoredFrame scored { nullptr, decoder.get_frame_number(), decoder.get_frame_pts() };
+                if (decoder.retrieve(scored.frame) < 0)
+                    continue;
+                scored.score = scorer.score(scored.frame.get(), scored.frame_number).total;
+                picker.offer(std::move(scored), picked);
+                if (!push_picked())
+                    break;
+                continue;
+            }
+            bool shown = false;
+#ifdef WITH_GUI
+            shown = preview.wanted();
+#endif
+            if (decoder.retrieve(frame) < 0)
+                continue;
+            Job job;
+            job.index = decoder.get_frame_number();
+            job.pts = decoder.get_frame_pts();
+            job.frame = std::move(frame);
+            job.shown = shown;
+            if (!decoded.push(std::move(job)))
+                break;
+        }
+        reached_end = !stop and ret == -1;
+        if (!stop) {
+            picker.finish(picked);
+            push_picked();
         }
+        decoded.close();
+    });
+
+    // Stage 2: color conversion, scaling and cropping in one pass, the pixel
+    // effects, and the smaller sizes from the larger ones.
+    std::thread convert_stage([&] {
+        FramePyramid pyramid { options.levels };
 #ifdef WITH_GUI
-        cv::imshow("preview", dump);
-        if (cv::waitKey(1) == 27)
-            break;
+        FrameConverter preview_converter { options.levels[0].geometry };
 #endif
+        EffectChain effects { options.effects, decoder_options.corruption.seed };
+        Job job;
+        while (decoded.pop(job)) {
+#ifdef WITH_GUI
+            // Only the size shown is made for the preview.
+            if (job.preview_only) {
+                cv::Mat image;
+                if (preview_converter.convert(job.frame.get(), image) == 0) {
+                    effects.apply(image, job.index);
+                    preview.offer(std::move(image));
+                }
+                preview_queued = false;
+                continue;
+            }
+#endif
+            if (pyramid.convert(job.frame.get(), job.images, &effects, job.index) < 0)
+                continue;
+            job.frame.reset();
+#ifdef WITH_GUI
+            if (job.shown)
+                preview.offer(cv::Mat { job.images[0] });
+#endif
+            converted.push(std::move(job));
+        }
+        converted.close();
+#ifdef WITH_GUI
+        preview.close();
+#endif
+    });
+
+    // Stage 3: hand the images over to the encoders. A checkpoint is only
+    // written once every image up to it is out.
+    std::thread export_stage([&] {
+        ImageFileSink files { options.encoder };
+        ImageSink& sink = options.sink ? *options.sink : files;
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options.checkpoint_interval));
+        auto next_checkpoint = std::chrono::steady_clock::now() + interval;
+        Job job;
+        while (converted.pop(job)) {
+            for (size_t i = 0; i < options.levels.size(); i++)
+                sink.write(export_dir / options.levels[i].name, video_file, job.index, job.images[i], options.levels[i].format);
+            if (log and job.pts != AV_NOPTS_VALUE and std::chrono::steady_clock::now() >= next_checkpoint) {
+                if (sink.flush())
+                    log->checkpoint(job.index, job.pts);
+                else
+                    written = false;
+                next_checkpoint = std::chrono::steady_clock::now() + interval;
+            }
+        }
+        if (!sink.flush())
+            written = false;
+        if (log and reached_end and written)
+            log->finish();
+    });
+
+    // Show the frames on the main thread, which does nothing else. The
+    // window keeps handling events while no frame comes. Press `ESC` to stop.
+#ifdef WITH_GUI
+    cv::Mat image;
+    while (!preview.finished()) {
+        if (preview.take(image, std::chrono::milliseconds(20)))
+            cv::imshow("preview", image);
+        if (cv::waitKey(1) == 27) {
+            stop = true;
+            preview.close();
+            break;
+        }
     }
+#endif
 
+    decode_stage.join();
+    convert_stage.join();
+    export_stage.join();
+
+    InputStats io = decoder.get_io_stats();
+    std::cout << "Input: " << io.bytes / (1 << 20) << " MB in " << io.reads << " reads, "
+              << io.seeks << " seeks, " << io.prefetched / (1 << 20) << " MB prefetched, "
+              << io.stall_ns / 1000000 << " ms waiting" << std::endl;
+    if (!written) {
+        std::cerr << "Some images could not be written." << std::endl;
+        return 1;
+    }
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+    // Safety check, always!
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+#ifdef WITH_METRICS
+    if (!options.prometheus_path.empty())
+        Metrics::instance().export_prometheus(options.prometheus_path, options.prometheus_interval);
+#else
+    if (!options.stats_path.empty() or !options.prometheus_path.empty())
+        std::cerr << "Built without WITH_METRICS, no stats will be written." << std::endl;
+#endif
+
+    // Images are encoded off the decoding threads. A dataset lives in the
+    // export dir, shared by every video and chunk.
+    std::unique_ptr<ImageSink> sink;
+    if (options.dataset and !options.remux and !options.stream) {
+        auto dataset = std::make_unique<DatasetWriter>(options.positional[1], options.dataset_encoding, options.encoder);
+        if (!dataset->is_valid())
+            return 1;
+        std::cout << "Appending to the dataset, " << dataset->size() << " images so far." << std::endl;
+        sink = std::move(dataset);
+    } else if (!options.remux and !options.stream) {
+        sink = std::make_unique<AsyncImageSink>(options.encoder, options.encoders);
+    }
+    options.sink = sink.get();
+
+    int ret = 0;
+    if (options.remux)
+        ret = run_remux(options);
+    else if (options.batch)
+        ret = run_batch(options);
+    else if (options.stream)
+        ret = run_stream(options);
+    else if (options.chunks > 1)
+        ret = run_chunked_export(options);
+    else
+        ret = run_export(options);
+    if (sink and !sink->flush()) {
+        std::cerr << "Some images could not be written." << std::endl;
+        ret = 1;
+    }
+
+#ifdef WITH_METRICS
+    if (!options.stats_path.empty() and !Metrics::instance().write_json(options.stats_path))
+        std::cerr << "Cannot write stats to: " << options.stats_path << std::endl;
+#endif
+    return ret;
+}
@@ -0,0 +1,126 @@
+#include "metrics.hpp"
+
+#ifdef WITH_METRICS
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+static const char* stage_names[] = { "demux", "send_packet", "receive_frame", "transfer", "convert", "resize", "effects", "score", "encode", "write" };
+static const char* counter_names[] = { "packets", "frames", "eagain", "decode_errors", "corruption_errors", "corrupted_packets", "corrupted_bytes", "input_bytes", "input_seeks", "preview_dropped", "contexts_reused", "low_score_frames", "rejected_decode_ns", "skipped_packets", "slow_frames", "corruption_backoffs" };
+
+Metrics::~Metrics()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (exporter.joinable())
+        exporter.join();
+}
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::record(Stage stage, uint64_t ns)
+{
+    Histogram& histogram = histograms[(int)stage];
+    int bucket = ns == 0 ? 0 : std::min(buckets - 1, 64 - __builtin_clzll(ns));
+    histogram.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = histogram.max.load(std::memory_order_relaxed);
+    while (ns > max and !histogram.max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+}
+
+void Metrics::add(Counter counter, uint64_t n)
+{
+    counters[(int)counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+std::string Metrics::to_json()
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::ostringstream out;
+    out << "{\n  \"elapsed_s\": " << seconds << ",\n  \"counters\": {";
+    for (int i = 0; i < (int)Counter::Count; i++)
+        out << (i ? ", " : "") << "\"" << counter_names[i] << "\": " << counters[i].load();
+    uint64_t frames = counters[(int)Counter::Frames].load();
+    out << "},\n  \"frames_per_second\": " << (seconds > 0 ? frames / seconds : 0) << ",\n  \"stages\": {";
+    for (int i = 0; i < (int)Stage::Count; i++) {
+        Histogram& histogram = histograms[i];
+        uint64_t count = histogram.count.load();
+        out << (i ? "," : "") << "\n    \"" << stage_names[i] << "\": {\"count\": " << count
+            << ", \"total_ns\": " << histogram.sum.load()
+            << ", \"mean_ns\": " << (count ? histogram.sum.load() / count : 0)
+            << ", \"max_ns\": " << histogram.max.load() << ", \"buckets_le_ns\": {";
+        // Only the buckets that have been hit, keyed by their upper bound.
+        bool first = true;
+        for (int b = 0; b < buckets; b++) {
+            uint64_t n = histogram.counts[b].load();
+            if (n == 0)
+                continue;
+            out << (first ? "" : ", ") << "\"" << (1ULL << b) << "\": " << n;
+            first = false;
+        }
+        out << "}}";
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+}
+
+std::string Metrics::to_prometheus()
+{
+    std::ostringstream out;
+    for (int i = 0; i < (int)Counter::Count; i++) {
+        out << "# TYPE glitch_" << counter_names[i] << "_total counter\n"
+            << "glitch_" << counter_names[i] << "_total " << counters[i].load() << "\n";
+    }
+    out << "# TYPE glitch_stage_seconds histogram\n";
+    for (int i = 0; i < (int)Stage::Count; i++) {
+        Histogram& histogram = histograms[i];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < buckets; b++) {
+            cumulative += histogram.counts[b].load();
+            // From 1us up, every 4x is plenty for a dashboard.
+            if (b < 10 or (b - 10) % 2 != 0)
+                continue;
+            out << "glitch_stage_seconds_bucket{stage=\"" << stage_names[i] << "\",le=\"" << (double)(1ULL << b) * 1e-9 << "\"} " << cumulative << "\n";
+        }
+        out << "glitch_stage_seconds_bucket{stage=\"" << stage_names[i] << "\",le=\"+Inf\"} " << histogram.count.load() << "\n"
+            << "glitch_stage_seconds_sum{stage=\"" << stage_names[i] << "\"} " << histogram.sum.load() * 1e-9 << "\n"
+            << "glitch_stage_seconds_count{stage=\"" << stage_names[i] << "\"} " << histogram.count.load() << "\n";
+    }
+    return out.str();
+}
+
+bool Metrics::write_json(const std::string& path)
+{
+    std::ofstream file { path };
+    file << to_json();
+    return file.good();
+}
+
+void Metrics::export_prometheus(const std::string& path, int interval_seconds)
+{
+    auto write = [this, path] {
+        // Write aside and rename, so the scraper never sees half a file.
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream file { temp };
+            file << to_prometheus();
+        }
+        std::rename(temp.c_str(), path.c_str());
+    };
+    exporter = std::thread([this, write, interval_seconds] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, std::chrono::seconds(interval_seconds), [this] { return stopping; }))
+            write();
+        write();
+    });
+}
+#endif // WITH_METRICS
@@ -0,0 +1,128 @@
+#if !defined(METRICS_HPP)
+#define METRICS_HPP
+
+#include "config.h"
+
+/// @brief Stages with timing histograms.
+enum class Stage {
+    Demux, // av_read_frame
+    SendPacket, // avcodec_send_packet
+    ReceiveFrame, // avcodec_receive_frame
+    Transfer, // av_hwframe_transfer_data
+    Convert, // color conversion
+    Resize, // scaling, with the color conversion or from a larger size
+    Effects, // pixel effects
+    Score, // scoring decoded frames
+    Encode, // JPEG, PNG or WebP encoding
+    Write, // writing images to disk
+    Count
+};
+
+/// @brief Event counters.
+enum class Counter {
+    Packets, // video packets sent to the decoder
+    Frames, // frames out of the decoder
+    Eagain, // the decoder asked for more data
+    DecodeErrors, // errors on untouched packets
+    CorruptionErrors, // errors on touched packets
+    CorruptedPackets,
+    CorruptedBytes,
+    InputBytes, // read by custom inputs
+    InputSeeks,
+    PreviewDropped, // frames made for the preview, replaced before it took them
+    ContextsReused, // decoders started from pooled contexts
+    LowScoreFrames, // decoded frames the scoring left out
+    RejectedDecodeNs, // time the decoder spent on packets and frames it rejected
+    SkippedPackets, // packets of damaged GOPs never decoded
+    SlowFrames, // frames over the decode time budget
+    CorruptionBackoffs, // times the corruption was lowered for too many failures
+    Count
+};
+
+#ifdef WITH_METRICS
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// @brief Process wide timing histograms and counters. Recording is a few
+/// relaxed atomic adds, so it can stay on in production runs.
+class Metrics {
+private:
+    // Power of 2 buckets of nanoseconds, up to about 9 minutes.
+    static const int buckets = 40;
+    struct Histogram {
+        std::atomic<uint64_t> counts[buckets] = {};
+        std::atomic<uint64_t> count { 0 };
+        std::atomic<uint64_t> sum { 0 };
+        std::atomic<uint64_t> max { 0 };
+    };
+    Histogram histograms[(int)Stage::Count];
+    std::atomic<uint64_t> counters[(int)Counter::Count] = {};
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    // Periodic export
+    std::thread exporter;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    Metrics() = default;
+
+public:
+    ~Metrics();
+
+    /// @brief Get the process wide instance.
+    static Metrics& instance();
+
+    /// @brief Record the duration of one stage.
+    void record(Stage stage, uint64_t ns);
+
+    /// @brief Add to a counter.
+    void add(Counter counter, uint64_t n = 1);
+
+    /// @brief Get a summary of all stages and counters.
+    std::string to_json();
+
+    /// @brief Get all stages and counters in the Prometheus text format.
+    std::string to_prometheus();
+
+    /// @brief Write the JSON summary to a file.
+    /// @return true if success.
+    bool write_json(const std::string& path);
+
+    /// @brief Write the Prometheus text file every few seconds, until the
+    /// process exits. The file is replaced atomically.
+    void export_prometheus(const std::string& path, int interval_seconds);
+};
+
+/// @brief Time the enclosing scope.
+class ScopedTimer {
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+    explicit ScopedTimer(Stage stage)
+        : stage(stage)
+    {
+    }
+    ~ScopedTimer()
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        Metrics::instance().record(stage, ns);
+    }
+};
+
+#define METRICS_CONCAT_(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT_(a, b)
+#define METRICS_TIME(stage) ScopedTimer METRICS_CONCAT(metrics_timer_, __LINE__) { stage }
+#define METRICS_COUNT(counter, n) Metrics::instance().add(counter, n)
+#else
+#define METRICS_TIME(stage) ((void)0)
+#define METRICS_COUNT(counter, n) ((void)sizeof(n)) // n is not evaluated
+#endif // WITH_METRICS
+#endif // METRICS_HPP
@@ -0,0 +1,233 @@
+#include "run_log.hpp"
+#include "file_io.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[8] = { 'G', 'L', 'I', 'T', 'C', 'H', 'R', 'L' };
+static const uint32_t version = 1;
+static const size_t header_size = 48;
+static const size_t buffer_limit = 1 << 20;
+
+enum RecordType : uint8_t {
+    CorruptionRecordType = 1,
+    CheckpointRecordType = 2,
+    FinishedRecordType = 3,
+};
+
+template <typename T>
+static void put(std::vector<uint8_t>& out, T value)
+{
+    const uint8_t* bytes = (const uint8_t*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Read a value, false past the end.
+template <typename T>
+static bool get(const uint8_t*& data, const uint8_t* end, T& value)
+{
+    if (end - data < (ptrdiff_t)sizeof(T))
+        return false;
+    std::memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+static std::vector<uint8_t> make_header(const CorruptionOptions& options)
+{
+    std::vector<uint8_t> header(magic, magic + 8);
+    put(header, version);
+    put(header, (uint32_t)options.mode);
+    put(header, options.seed);
+    put(header, options.probability);
+    put(header, (int32_t)options.min_spans);
+    put(header, (int32_t)options.max_spans);
+    put(header, (int32_t)options.min_length);
+    put(header, (int32_t)options.max_length);
+    return header;
+}
+
+RunLog::RunLog(const std::filesystem::path& path, CorruptionOptions& options, bool resume)
+    : options(options)
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 or !recover(resume)) {
+        std::cerr << "Cannot open the run log: " << path.string() << std::endl;
+        failed = true;
+        return;
+    }
+    options = this->options;
+}
+
+RunLog::~RunLog()
+{
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        write_buffer();
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+// Read the records of an earlier run and get ready to append, or start over.
+bool RunLog::recover(bool resume)
+{
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+        return false;
+    std::vector<uint8_t> content(resume ? info.st_size : 0);
+    if (!content.empty() and pread(fd, content.data(), content.size(), 0) != (ssize_t)content.size())
+        return false;
+    if (content.size() < header_size or std::memcmp(content.data(), magic, 8) != 0) {
+        std::vector<uint8_t> header = make_header(options);
+        return ftruncate(fd, 0) == 0 and pwrite(fd, header.data(), header.size(), 0) == (ssize_t)header.size()
+            and lseek(fd, 0, SEEK_END) >= 0;
+    }
+
+    // The glitches must be the same as before.
+    const uint8_t* data = content.data() + 12;
+    const uint8_t* end = content.data() + content.size();
+    uint32_t mode;
+    int32_t spans[4];
+    get(data, end, mode);
+    get(data, end, options.seed);
+    get(data, end, options.probability);
+    for (int32_t& value : spans)
+        get(data, end, value);
+    options.mode = (CorruptionMode)mode;
+    options.min_spans = spans[0];
+    options.max_spans = spans[1];
+    options.min_length = spans[2];
+    options.max_length = spans[3];
+
+    // Records up to the first one written half.
+    size_t valid = header_size;
+    data = content.data() + header_size;
+    while (true) {
+        uint32_t size;
+        uint8_t type;
+        const uint8_t* record = data;
+        if (!get(record, end, size) or size == 0 or end - record < (ptrdiff_t)size)
+            break;
+        const uint8_t* record_end = record + size;
+        get(record, record_end, type);
+        if (type == CorruptionRecordType) {
+            int32_t stream;
+            int64_t pts, dts, pos;
+            uint32_t count;
+            if (!get(record, record_end, stream) or !get(record, record_end, pts) or !get(record, record_end, dts)
+                or !get(record, record_end, pos) or !get(record, record_end, count) or count > (size_t)(record_end - record) / 16)
+                break;
+            std::vector<CorruptionSpan> spans(count);
+            bool complete = true;
+            for (auto&& span : spans)
+                complete = complete and get(record, record_end, span.offset) and get(record, record_end, span.length) and get(record, record_end, span.key);
+            if (!complete)
+                break;
+            corruptions[{ stream, pts, dts, pos }] = std::move(spans);
+        } else if (type == CheckpointRecordType) {
+            if (!get(record, record_end, last.frame_number) or !get(record, record_end, last.pts))
+                break;
+        } else if (type == FinishedRecordType) {
+            finished = true;
+        } else {
+            break;
+        }
+        data = record_end;
+        valid = data - content.data();
+    }
+    if (!corruptions.empty() or last.pts != AV_NOPTS_VALUE)
+        std::cout << "Resuming after frame " << last.frame_number << ", " << corruptions.size() << " corrupted packets logged" << std::endl;
+    return ftruncate(fd, valid) == 0 and lseek(fd, 0, SEEK_END) >= 0;
+}
+
+bool RunLog::write_buffer()
+{
+    if (failed)
+        return false;
+    if (!write_all(fd, buffer.data(), buffer.size())) {
+        std::cerr << "Cannot write the run log: " << std::strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+    buffer.clear();
+    return true;
+}
+
+bool RunLog::is_valid()
+{
+    return !failed;
+}
+
+RunLog::Checkpoint RunLog::get_checkpoint()
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    return last;
+}
+
+bool RunLog::is_finished()
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    return finished;
+}
+
+bool RunLog::find(const AVPacket* packet, std::vector<CorruptionSpan>& spans)
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    auto found = corruptions.find({ packet->stream_index, packet->pts, packet->dts, packet->pos });
+    if (found == corruptions.end())
+        return false;
+    spans = found->second;
+    return true;
+}
+
+void RunLog::record(const CorruptionRecord& record)
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    if (failed)
+        return;
+    put(buffer, (uint32_t)(1 + 4 + 8 * 3 + 4 + record.spans.size() * 16));
+    put(buffer, (uint8_t)CorruptionRecordType);
+    put(buffer, (int32_t)record.stream_index);
+    put(buffer, record.pts);
+    put(buffer, record.dts);
+    put(buffer, record.pos);
+    put(buffer, (uint32_t)record.spans.size());
+    for (auto&& span : record.spans) {
+        put(buffer, span.offset);
+        put(buffer, span.length);
+        put(buffer, span.key);
+    }
+    if (buffer.size() >= buffer_limit)
+        write_buffer();
+}
+
+bool RunLog::checkpoint(int frame_number, int64_t pts)
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    put(buffer, (uint32_t)(1 + 4 + 8));
+    put(buffer, (uint8_t)CheckpointRecordType);
+    put(buffer, (int32_t)frame_number);
+    put(buffer, pts);
+    return write_buffer() and fdatasync(fd) == 0;
+}
+
+bool RunLog::finish()
+{
+    std::lock_guard<std::mutex> lock { mutex };
+    put(buffer, (uint32_t)1);
+    put(buffer, (uint8_t)FinishedRecordType);
+    return write_buffer() and fdatasync(fd) == 0;
+}
+
+std::filesystem::path run_log_path(const std::filesystem::path& export_dir, int64_t start)
+{
+    if (start == INT64_MIN)
+        return export_dir / "glitch.log";
+    return export_dir / ("glitch-" + std::to_string(start) + ".log");
+}
@@ -0,0 +1,92 @@
+#if !defined(RUN_LOG_HPP)
+#define RUN_LOG_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "corruption_engine.hpp"
+
+// A run log is an append-only file next to the exported images:
+//   48 byte header: "GLITCHRL", version, then the corruption options
+//   records: uint32 size, uint8 type, then the payload of that size - 1
+//     1 corruption: int32 stream, int64 pts, dts, pos, uint32 count,
+//       then count spans of int32 offset, int32 length, uint64 key, none
+//       for a packet spared by a lowered intensity
+//     2 checkpoint: int32 frame number, int64 pts
+//     3 finished
+// All numbers are little endian. Opening the log again cuts off a record
+// written half.
+
+/// @brief Progress of an export and every corruption it made, so a killed
+/// run can carry on from its last checkpoint with the very same glitches.
+/// Corruptions are collected in memory and written with the next
+/// checkpoint. Thread safe.
+class RunLog {
+public:
+    /// @brief The last frame known to be exported, with every frame before it.
+    struct Checkpoint {
+        int frame_number = 0;
+        int64_t pts = AV_NOPTS_VALUE;
+    };
+
+private:
+    using PacketId = std::tuple<int, int64_t, int64_t, int64_t>; // stream, pts, dts, pos
+
+    std::mutex mutex;
+    int fd = -1;
+    bool failed = false;
+    CorruptionOptions options;
+    std::map<PacketId, std::vector<CorruptionSpan>> corruptions; // from earlier runs
+    Checkpoint last;
+    bool finished = false;
+    std::vector<uint8_t> buffer; // records not written yet
+
+    bool recover(bool resume);
+    bool write_buffer();
+
+public:
+    /// @brief Open a log, resuming from it or starting over.
+    /// @param path the log file.
+    /// @param options the corruption of this run. When resuming, replaced by
+    /// the options of the run that wrote the log.
+    /// @param resume if false, an existing log is emptied.
+    RunLog(const std::filesystem::path& path, CorruptionOptions& options, bool resume);
+    ~RunLog();
+    RunLog(const RunLog&) = delete;
+    RunLog& operator=(const RunLog&) = delete;
+
+    /// @brief Check if the log could be opened.
+    bool is_valid();
+
+    /// @brief Get the last checkpoint of earlier runs, a pts of
+    /// AV_NOPTS_VALUE if there is none.
+    Checkpoint get_checkpoint();
+
+    /// @brief Check if an earlier run exported everything.
+    bool is_finished();
+
+    /// @brief Find the logged corruption of a packet.
+    /// @return true if an earlier run touched it.
+    bool find(const AVPacket* packet, std::vector<CorruptionSpan>& spans);
+
+    /// @brief Log the corruption of a packet.
+    void record(const CorruptionRecord& record);
+
+    /// @brief Log that every frame up to this one is exported, and sync the
+    /// log to disk.
+    /// @return true if success.
+    bool checkpoint(int frame_number, int64_t pts);
+
+    /// @brief Log that the export is complete.
+    /// @return true if success.
+    bool finish();
+};
+
+/// @brief Get the log of an export range, `glitch.log` for the whole video.
+/// @param start the first timestamp of the range.
+std::filesystem::path run_log_path(const std::filesystem::path& export_dir, int64_t start = INT64_MIN);
+#endif // RUN_LOG_HPP
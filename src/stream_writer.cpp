@@ -0,0 +1,89 @@
+#include "stream_writer.hpp"
+#include "metrics.hpp"
+
+#include <iostream>
+#include <string>
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+StreamWriter::StreamWriter(FILE* file, StreamFormat format, AVRational frame_rate)
+    : file(file)
+    , format(format)
+    , frame_rate(frame_rate)
+{
+    // Whole frames are written at once, the stdio buffer only adds a copy.
+    setvbuf(file, nullptr, _IONBF, 0);
+}
+
+StreamWriter::~StreamWriter()
+{
+    if (ctx_sws)
+        sws_freeContext(ctx_sws);
+}
+
+// Planes of yuv420p packed one after another, converted and scaled if
+// necessary.
+int StreamWriter::pack_yuv(const AVFrame* frame)
+{
+    int size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+    buffer.resize(size);
+    AVPixelFormat src_fmt = (AVPixelFormat)frame->format;
+    bool same_size = frame->width == width and frame->height == height;
+    if (same_size and (src_fmt == AV_PIX_FMT_YUV420P or src_fmt == AV_PIX_FMT_YUVJ420P)) {
+        int ret = av_image_copy_to_buffer(buffer.data(), size, frame->data, frame->linesize, src_fmt, frame->width, frame->height, 1);
+        return ret < 0 ? ret : 0;
+    }
+
+    ctx_sws = sws_getCachedContext(ctx_sws, frame->width, frame->height, src_fmt,
+        width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if (!ctx_sws) {
+        std::cerr << "Cannot init SWS context." << std::endl;
+        return -1;
+    }
+    uint8_t* dst_data[4];
+    int dst_linesize[4];
+    av_image_fill_arrays(dst_data, dst_linesize, buffer.data(), AV_PIX_FMT_YUV420P, width, height, 1);
+    return sws_scale(ctx_sws, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize) == height ? 0 : -1;
+}
+
+int StreamWriter::write(const AVFrame* frame)
+{
+    int ret = 0;
+    if (width == 0) {
+        width = frame->width;
+        height = frame->height;
+        OutputGeometry geometry;
+        geometry.width = width;
+        geometry.height = height;
+        geometry.crop = CropMode::Stretch;
+        converter.set_geometry(geometry);
+    }
+    if (format == StreamFormat::RawBgr) {
+        METRICS_TIME(Stage::Convert);
+        buffer.resize((size_t)width * height * 3);
+        ret = converter.convert(frame, buffer.data(), width * 3);
+    } else {
+        METRICS_TIME(Stage::Convert);
+        ret = pack_yuv(frame);
+    }
+    if (ret < 0)
+        return ret;
+
+    METRICS_TIME(Stage::Write);
+    if (format == StreamFormat::Y4m) {
+        if (!header_written) {
+            bool full_range = frame->format == AV_PIX_FMT_YUVJ420P or frame->color_range == AVCOL_RANGE_JPEG;
+            std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height)
+                + " F" + std::to_string(frame_rate.num) + ":" + std::to_string(frame_rate.den)
+                + " Ip A0:0 C420jpeg" + (full_range ? " XCOLORRANGE=FULL" : " XCOLORRANGE=LIMITED") + "\n";
+            if (fwrite(header.data(), 1, header.size(), file) != header.size())
+                return -1;
+            header_written = true;
+        }
+        if (fwrite("FRAME\n", 1, 6, file) != 6)
+            return -1;
+    }
+    return fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() ? 0 : -1;
+}
@@ -0,0 +1,55 @@
+#if !defined(STREAM_WRITER_HPP)
+#define STREAM_WRITER_HPP
+
+#include <cstdio>
+#include <vector>
+
+#include "frame_converter.hpp"
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+}
+
+/// @brief Raw video formats for streaming.
+enum class StreamFormat {
+    Y4m, // YUV4MPEG2, 4:2:0 with a header, readable by `ffmpeg -f yuv4mpegpipe`
+    RawBgr, // bare bgr24 frames
+    RawYuv, // bare yuv420p frames
+};
+
+/// @brief Write decoded frames one after another into a file or pipe, like
+/// stdout. Every frame is packed into one buffer and written in one go, no
+/// matter its pixel format in the decoder. Readers take the size from the
+/// header or the first frame, so later frames of another size, like after a
+/// resolution change, are scaled to the first one.
+class StreamWriter {
+private:
+    FILE* file;
+    StreamFormat format;
+    AVRational frame_rate;
+    bool header_written = false;
+    int width = 0, height = 0; // of the first frame, 0 before it
+    std::vector<uint8_t> buffer;
+
+    SwsContext* ctx_sws = nullptr; // to yuv420p
+    FrameConverter converter; // to bgr24
+
+    int pack_yuv(const AVFrame* frame);
+
+public:
+    /// @brief Create a writer.
+    /// @param file where to write, not closed by the writer.
+    /// @param format the output format.
+    /// @param frame_rate written into the Y4M header.
+    StreamWriter(FILE* file, StreamFormat format, AVRational frame_rate);
+    StreamWriter(const StreamWriter&) = delete;
+    StreamWriter& operator=(const StreamWriter&) = delete;
+    ~StreamWriter();
+
+    /// @brief Write a frame.
+    /// @param frame a decoded frame in system memory.
+    /// @return 0 if success, else negative, like when the reader is gone.
+    int write(const AVFrame* frame);
+};
+#endif // STREAM_WRITER_HPP
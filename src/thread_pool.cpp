@@ -0,0 +1,125 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+// The worker the current thread belongs to, if any.
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(size_t size)
+{
+    if (size == 0)
+        size = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < size; i++)
+        workers.emplace_back(new Worker);
+    for (size_t i = 0; i < size; i++)
+        threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto&& thread : threads)
+        thread.join();
+}
+
+size_t ThreadPool::size()
+{
+    return workers.size();
+}
+
+void ThreadPool::submit(Task task)
+{
+    pending++;
+    size_t id = current_pool == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[id]->mutex);
+        workers[id]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::pop(size_t id, Task& task)
+{
+    Worker& worker = *workers[id];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty())
+        return false;
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(size_t id, Task& task)
+{
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& victim = *workers[(id + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty())
+            continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t id)
+{
+    current_pool = this;
+    current_worker = id;
+    while (true) {
+        Task task;
+        if (pop(id, task) or steal(id, task)) {
+            queued--;
+            task();
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping or queued > 0; });
+        if (stopping and queued <= 0)
+            return;
+    }
+}
+
+ResourceBudget::ResourceBudget(size_t capacity)
+    : capacity(capacity)
+{
+}
+
+size_t ResourceBudget::acquire(size_t amount)
+{
+    amount = std::min(amount, capacity);
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [&] { return used + amount <= capacity; });
+    used += amount;
+    return amount;
+}
+
+void ResourceBudget::release(size_t amount)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        used -= amount;
+    }
+    released.notify_all();
+}
@@ -0,0 +1,77 @@
+#if !defined(THREAD_POOL_HPP)
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief A work stealing thread pool. Every worker has its own task queue:
+/// it takes the newest task from its own queue, and when that runs dry it
+/// steals the oldest task from another worker. Tasks submitted from inside a
+/// task go to the current worker's queue, so a long job can split itself and
+/// let idle workers pick up the pieces.
+class ThreadPool {
+private:
+    using Task = std::function<void()>;
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // Sleeping and waking
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+    std::atomic<long> queued { 0 }; // tasks waiting in the queues
+    std::atomic<long> pending { 0 }; // tasks queued or running
+    std::atomic<size_t> next_worker { 0 };
+    bool stopping = false;
+
+    bool pop(size_t id, Task& task);
+    bool steal(size_t id, Task& task);
+    void run(size_t id);
+
+public:
+    /// @brief Create a pool.
+    /// @param size number of workers, 0 for all cores.
+    explicit ThreadPool(size_t size = 0);
+    ~ThreadPool();
+
+    /// @brief Get the number of workers.
+    size_t size();
+
+    /// @brief Queue a task.
+    void submit(Task task);
+
+    /// @brief Wait until every task, including the ones they submitted, is done.
+    void wait();
+};
+
+/// @brief A counting budget, like the memory all running jobs may use.
+/// Amounts larger than the whole budget are clamped to it, so a big job
+/// runs alone instead of waiting forever.
+class ResourceBudget {
+private:
+    size_t capacity;
+    size_t used = 0;
+    std::mutex mutex;
+    std::condition_variable released;
+
+public:
+    explicit ResourceBudget(size_t capacity);
+
+    /// @brief Take from the budget, waiting until enough is left.
+    /// @return the amount taken, to be released later.
+    size_t acquire(size_t amount);
+
+    /// @brief Give back to the budget.
+    void release(size_t amount);
+};
+#endif // THREAD_POOL_HPP
@@ -1,23 +1,37 @@
 #include "video_decoder.hpp"
+#include "metrics.hpp"
+#include "run_log.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
 
 AVPixelFormat VideoDecoder::hw_pix_fmt;
 
-VideoDecoder::VideoDecoder(const std::string url, AVHWDeviceType hw_acc)
+VideoDecoder::VideoDecoder(const std::string url, AVHWDeviceType hw_acc, DecoderOptions options)
+    : corruption(options.corruption)
+    , log(options.log)
+    , errors(options.errors)
+    , pool(options.pool_capacity)
 {
     // Init the flags
     this->initialized = true;
 
-    // Is this file valid?
-    if (avformat_open_input(&ctx_format, url.c_str(), nullptr, nullptr) < 0) {
-        std::cerr << "Cannot open input file:" << url << std::endl;
-        initialized &= false;
+    // Pipes and local files are read through our own I/O context.
+    input = open_input_source(url, options.io);
+    if (input and input->is_valid()) {
+        ctx_format = avformat_alloc_context();
+        ctx_format->pb = input->get_context();
+        ctx_format->flags |= AVFMT_FLAG_CUSTOM_IO;
     }
 
-    // Is there any valid video stream to be processed?
-    if (avformat_find_stream_info(ctx_format, nullptr) < 0) {
-        std::cerr << "Cannot find stream information." << std::endl;
+    // Is this file valid, with any stream information?
+    if (open_stream(url, options.fast_open) < 0) {
         initialized &= false;
+        return;
     }
+
+    // Is there any valid video stream to be processed?
     if ((stream_index = av_find_best_stream(ctx_format, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0)) < 0) {
         std::cerr << "Cannot find valid stream: " << av_get_media_type_string(AVMEDIA_TYPE_VIDEO) << std::endl;
         initialized &= false;
@@ -56,19 +70,124 @@ VideoDecoder::VideoDecoder(const std::string url, AVHWDeviceType hw_acc)
         }
     }
 
-    // Now it's time to init the decoder.
+    if (!initialized)
+        return;
+
+    // Now it's time to init the decoder, or to take one opened for an
+    // earlier video like this one.
+    if (options.contexts) {
+        contexts = options.contexts;
+        contexts_key = make_contexts_key(options);
+        DecoderPool::Contexts reused = contexts->take(contexts_key);
+        ctx_decode = reused.codec;
+        converter.adopt_context(reused.sws);
+        hw_acc_enabled = ctx_decode and ctx_decode->hw_device_ctx;
+    }
+    if (!ctx_decode and open_decoder(options) < 0) {
+        initialized &= false;
+        return;
+    }
+
+    // Init the frames
+    if (!(frame = av_frame_alloc()) or !(frame_hw = av_frame_alloc()) or !(frame_bgr = av_frame_alloc())) {
+        std::cerr << "Cannot allocate frame." << std::endl;
+        initialized &= false;
+    }
+
+    // Init the packet
+    if (!(packet = av_packet_alloc())) {
+        std::cerr << "Cannot allocate packet." << std::endl;
+        initialized &= false;
+    }
+    if (!initialized)
+        return;
+
+    // Only the scaled and cropped frame is kept in BGR.
+    converter.set_geometry(options.output);
+    cv::Size output_size = converter.output_size(ctx_decode->width, ctx_decode->height);
+    if (pool.get(frame_bgr, output_fmt, output_size.width, output_size.height) < 0) {
+        std::cerr << "Cannot allocate SWS frame buffer." << std::endl;
+        initialized &= false;
+    }
+}
+
+// MP4, MOV and Matroska list every stream with its codec and size in the
+// header. Reading packets to find them adds nothing the decoder needs.
+static bool header_describes_streams(const AVFormatContext* ctx)
+{
+    const char* name = ctx->iformat->name;
+    if (!std::strstr(name, "mp4") and !std::strstr(name, "matroska"))
+        return false;
+    for (unsigned i = 0; i < ctx->nb_streams; i++) {
+        const AVCodecParameters* par = ctx->streams[i]->codecpar;
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO and (par->codec_id == AV_CODEC_ID_NONE or par->width <= 0 or par->height <= 0))
+            return false;
+    }
+    return true;
+}
+
+int VideoDecoder::open_stream(const std::string& url, bool fast_open)
+{
+    // The format is known from the first few KB.
+    AVDictionary* format_options = nullptr;
+    if (fast_open)
+        av_dict_set(&format_options, "probesize", "32768", 0);
+    int ret = avformat_open_input(&ctx_format, url.c_str(), nullptr, &format_options);
+    av_dict_free(&format_options);
+    if (ret < 0) {
+        std::cerr << "Cannot open input file:" << url << std::endl;
+        return ret;
+    }
+    if (fast_open and header_describes_streams(ctx_format))
+        return 0;
+
+    // Other containers are probed as usual, with FFmpeg's default size.
+    ctx_format->probesize = 5000000;
+    if ((ret = avformat_find_stream_info(ctx_format, nullptr)) < 0) {
+        std::cerr << "Cannot find stream information." << std::endl;
+        return ret;
+    }
+    return 0;
+}
+
+std::string VideoDecoder::make_contexts_key(const DecoderOptions& options)
+{
+    // Everything the contexts are opened with: the codec parameters, the
+    // device, the threads, the shortcuts of preview quality, the error
+    // handling and the scaling.
+    const AVCodecParameters* par = stream->codecpar;
+    const OutputGeometry& output = options.output;
+    std::ostringstream key;
+    key << par->codec_id << ' ' << par->profile << ' ' << par->width << 'x' << par->height << ' ' << par->format
+        << ' ' << enabled_hw_accelerator << ' ' << options.threads << ' ' << (int)options.thread_type
+        << ' ' << (int)options.quality << ' ' << options.errors.recognition << ' ' << options.errors.concealment
+        << ' ' << output.width << 'x' << output.height << ' ' << (int)output.crop
+        << ' ' << output.roi.x << ',' << output.roi.y << ',' << output.roi.width << ',' << output.roi.height
+        << ' ' << output.interpolation << ' ';
+    if (par->extradata)
+        key.write((const char*)par->extradata, par->extradata_size);
+    return key.str();
+}
+
+int VideoDecoder::open_decoder(const DecoderOptions& options)
+{
     this->ctx_decode = avcodec_alloc_context3(decoder);
     if (!ctx_decode) {
         std::cerr << "Cannot allocate decoder context." << std::endl;
-        initialized &= false;
+        return AVERROR(ENOMEM);
     }
     if (avcodec_parameters_to_context(ctx_decode, stream->codecpar) < 0) {
         std::cerr << "Cannot copy decoder parameters to input decoder context." << std::endl;
-        initialized &= false;
+        return -1;
     }
 
     if (enabled_hw_accelerator != AV_HWDEVICE_TYPE_NONE) {
-        if (av_hwdevice_ctx_create(&hw_device_ctx, enabled_hw_accelerator, nullptr, nullptr, 0) == 0) {
+        // Devices are shared by every decoder of a pool.
+        if (contexts)
+            hw_device_ctx = contexts->device(enabled_hw_accelerator);
+        else if (av_hwdevice_ctx_create(&hw_device_ctx, enabled_hw_accelerator, nullptr, nullptr, 0) < 0)
+            hw_device_ctx = nullptr;
+        if (hw_device_ctx) {
             ctx_decode->hw_device_ctx = av_buffer_ref(hw_device_ctx);
             ctx_decode->get_format = get_hw_format;
             this->hw_acc_enabled = true;
@@ -79,49 +198,46 @@ VideoDecoder::VideoDecoder(const std::string url, AVHWDeviceType hw_acc)
             std::cerr << "Cannot create context for specified hardware device." << std::endl;
         }
     }
-    if (avcodec_open2(ctx_decode, decoder, nullptr) < 0) {
-        std::cerr << "Cannot open decoder for stream: " << stream_index << std::endl;
-        initialized &= false;
-    }
 
-    // Init the frames
-    if (!(frame = av_frame_alloc()) or !(frame_hw = av_frame_alloc()) or !(frame_bgr = av_frame_alloc())) {
-        std::cerr << "Cannot allocate frame." << std::endl;
-        initialized &= false;
-    }
-
-    // Init the packet
-    if (!(packet = av_packet_alloc())) {
-        std::cerr << "Cannot allocate packet." << std::endl;
-        initialized &= false;
-    }
-
-    // Create SWS Context for converting from decode pixel format (like YUV420) to BGR
-    ctx_sws = sws_getContext(ctx_decode->width,
-        ctx_decode->height,
-        ctx_decode->pix_fmt,
-        ctx_decode->width,
-        ctx_decode->height,
-        this->output_fmt,
-        SWS_BICUBIC,
-        nullptr,
-        nullptr,
-        nullptr);
-    if (ctx_sws == nullptr) {
-        std::cerr << "Cannot init SWS context." << std::endl;
-        initialized &= false;
+    // Software decoding scales with threads. FFmpeg caps its own "auto" at 16
+    // threads, so count the cores here to use all of them.
+    if (!hw_acc_enabled) {
+        int threads = options.threads;
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        ctx_decode->thread_count = threads;
+        switch (options.thread_type) {
+        case ThreadType::Frame:
+            ctx_decode->thread_type = FF_THREAD_FRAME;
+            break;
+        case ThreadType::Slice:
+            ctx_decode->thread_type = FF_THREAD_SLICE;
+            break;
+        default:
+            ctx_decode->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            break;
+        }
     }
-    frame_bgr->format = this->output_fmt;
-    frame_bgr->width = ctx_decode->width;
-    frame_bgr->height = ctx_decode->height;
-    if (av_frame_get_buffer(frame_bgr, 0) < 0) {
-        std::cerr << "Cannot allocate SWS frame buffer." << std::endl;
-        initialized &= false;
+    if (options.quality == DecodeQuality::Preview and !hw_acc_enabled)
+        set_preview_quality(options.output);
+    if (options.errors.recognition >= 0)
+        ctx_decode->err_recognition = options.errors.recognition;
+    if (options.errors.concealment >= 0)
+        ctx_decode->error_concealment = options.errors.concealment;
+    if (avcodec_open2(ctx_decode, decoder, nullptr) < 0) {
+        std::cerr << "Cannot open decoder for stream: " << stream_index << std::endl;
+        return -1;
     }
+    return 0;
 }
 
 VideoDecoder::~VideoDecoder()
 {
+    // An opened decoder goes back to the pool, for the next video like this.
+    if (contexts and ctx_decode and avcodec_is_open(ctx_decode)) {
+        contexts->give(contexts_key, { ctx_decode, converter.release_context() });
+        ctx_decode = nullptr;
+    }
     if (packet)
         av_packet_free(&packet);
     if (frame)
@@ -130,10 +246,12 @@ VideoDecoder::~VideoDecoder()
         av_frame_free(&frame_hw);
     if (ctx_decode)
         avcodec_free_context(&ctx_decode);
+    if (frame_bgr)
+        av_frame_free(&frame_bgr);
     if (ctx_format)
         avformat_close_input(&ctx_format);
-    if (ctx_sws)
-        sws_freeContext(ctx_sws);
+    if (hw_device_ctx)
+        av_buffer_unref(&hw_device_ctx);
 }
 void VideoDecoder::query_supported_hw_devices(std::vector<AVHWDeviceType>& types)
 {
@@ -153,51 +271,71 @@ AVPixelFormat VideoDecoder::get_hw_format(AVCodecContext* ctx, const enum AVPixe
     return AV_PIX_FMT_NONE;
 }
 
+void VideoDecoder::set_preview_quality(const OutputGeometry& output)
+{
+    // How much smaller is the output than the source?
+    int width = ctx_decode->width, height = ctx_decode->height;
+    if (output.width <= 0 or output.height <= 0 or width <= 0 or height <= 0)
+        return;
+    float scale = std::max(output.width / (float)width, output.height / (float)height);
+    if (scale >= 1.0f)
+        return;
+
+    // Decode at 1/2, 1/4 or 1/8 of the size while it still covers the output.
+    // A ROI is given in full resolution pixels, so it keeps the full size.
+    int lowres = 0;
+    if (output.crop != CropMode::Roi) {
+        while (lowres < decoder->max_lowres and scale * (2 << lowres) <= 1.0f)
+            lowres++;
+    }
+    ctx_decode->lowres = lowres;
+
+    // The in-loop filters only smooth block edges, the glitch comes from the
+    // corrupted bitstream. Frames are never skipped, that would change the
+    // frame numbering.
+    ctx_decode->skip_loop_filter = AVDISCARD_ALL;
+    ctx_decode->flags2 |= AV_CODEC_FLAG2_FAST;
+    if (scale <= 0.25f)
+        ctx_decode->skip_idct = AVDISCARD_BIDIR;
+    std::cout << "Preview quality decoding, lowres: " << lowres << std::endl;
+}
+
 void VideoDecoder::random_touch()
 {
-    // Standard mersenne_twister_engine seeded with rd()
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> corruption_count(1, 6);
-    std::uniform_int_distribution<> start(0, packet->size - 1);
-    std::uniform_int_distribution<> length(1, packet->size - 1);
-    std::uniform_int_distribution<> val(0, 255);
-    int random_start = start(gen);
-    for (size_t i = 0, count = corruption_count(gen); i < count; i++) {
-        for (int j = 0, random_length = length(gen); j < random_length; j++) {
-            if (random_start + j >= packet->size) {
-                break;
-            }
-            packet->data[random_start + j] = val(gen);
-        }
+    // A resumed run replays what the log says, whatever the engine decides.
+    int64_t touched;
+    if (log and log->find(packet, record.spans)) {
+        touched = corruption.replay(packet, record.spans);
+    } else {
+        touched = corruption.touch(packet, log ? &record : nullptr);
+        // A packet spared by a lowered intensity is logged without any span,
+        // so a resumed run spares it too.
+        if (log and (touched > 0 or intensity < 1))
+            log->record(record);
+    }
+    if (touched > 0) {
+        METRICS_COUNT(Counter::CorruptedPackets, 1);
+        METRICS_COUNT(Counter::CorruptedBytes, touched);
     }
 }
 
 int VideoDecoder::to_bgr()
 {
-    ctx_sws = sws_getCachedContext(ctx_sws,
-        ctx_decode->width,
-        ctx_decode->height,
-        (AVPixelFormat)frame->format,
-        ctx_decode->width,
-        ctx_decode->height,
-        output_fmt,
-        SWS_BICUBIC,
-        nullptr,
-        nullptr,
-        nullptr);
-    int out_height = sws_scale(ctx_sws,
-        frame->data,
-        frame->linesize,
-        0,
-        frame->height,
-        frame_bgr->data,
-        frame_bgr->linesize);
-    if (out_height != frame_bgr->height) {
-        std::cerr << "Cannot convert image, out height: " << out_height << std::endl;
+    cv::Size output_size = converter.output_size(frame->width, frame->height);
+    if (output_size.width != frame_bgr->width or output_size.height != frame_bgr->height) {
+        std::cerr << "Frame size changed: " << frame->width << "x" << frame->height << std::endl;
         return -1;
     }
-    return 0;
+
+    // Frames handed out by retrieve_bgr() still hold the buffer, take a new
+    // one instead of overwriting theirs.
+    if (!av_frame_is_writable(frame_bgr)) {
+        av_frame_unref(frame_bgr);
+        int ret = pool.get(frame_bgr, output_fmt, output_size.width, output_size.height);
+        if (ret < 0)
+            return ret;
+    }
+    return converter.convert(frame, frame_bgr->data[0], frame_bgr->linesize[0]);
 }
 
 std::vector<std::string> VideoDecoder::list_hw_accelerators()
@@ -222,11 +360,32 @@ bool VideoDecoder::is_accelerated()
 std::pair<int, int> VideoDecoder::get_frame_dims()
 {
     std::pair<int, int> dims;
-    dims.first = this->ctx_decode->width;
-    dims.second = this->ctx_decode->height;
+    if (!frame_bgr)
+        return dims;
+    dims.first = this->frame_bgr->width;
+    dims.second = this->frame_bgr->height;
     return dims;
 }
 
+std::pair<int, int> VideoDecoder::get_source_dims()
+{
+    return { ctx_decode->width, ctx_decode->height };
+}
+
+InputStats VideoDecoder::get_io_stats()
+{
+    return input ? input->get_stats() : InputStats {};
+}
+
+AVRational VideoDecoder::get_frame_rate()
+{
+    if (stream and stream->avg_frame_rate.num > 0 and stream->avg_frame_rate.den > 0)
+        return stream->avg_frame_rate;
+    if (stream and stream->r_frame_rate.num > 0 and stream->r_frame_rate.den > 0)
+        return stream->r_frame_rate;
+    return AVRational { 25, 1 };
+}
+
 int VideoDecoder::get_frame_steps()
 {
     return frame_bgr->linesize[0];
@@ -240,60 +399,525 @@ uint8_t* VideoDecoder::get_buffer()
         return nullptr;
 }
 
-int VideoDecoder::read(bool touch)
+int VideoDecoder::grab(bool touch)
 {
     int ret = 0;
+    downloaded = converted = false;
+    AVFrame* frame_out = hw_acc_enabled ? frame_hw : frame;
+
+    // A decoder failing on every frame of a GOP would keep this loop busy
+    // for long, the time budget and the error count bound it.
+    using Clock = std::chrono::steady_clock;
+    const bool budgeted = touch and errors.frame_budget > 0;
+    const auto budget = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(errors.frame_budget));
+    const int max_errors_in_row = 16;
+    auto started = Clock::now();
+    int errors_in_row = 0;
 
-    // Fetch a frame
-    ret = av_read_frame(ctx_format, packet);
+    while (true) {
+        // Frames drained when a GOP was skipped come first.
+        if (!drained.empty()) {
+            av_frame_unref(frame_out);
+            av_frame_move_ref(frame_out, drained.front().get());
+            drained.pop_front();
+            break;
+        }
+
+        // Frame got? With frame threading the decoder holds back several
+        // packets before the first frame comes out.
+        auto receiving = Clock::now();
+        {
+            METRICS_TIME(Stage::ReceiveFrame);
+            ret = avcodec_receive_frame(ctx_decode, frame_out);
+        }
+        if (ret == 0)
+            break;
+        if (ret == AVERROR_EOF)
+            return -1;
+        if (ret == AVERROR(EAGAIN)) {
+            METRICS_COUNT(Counter::Eagain, 1);
+        } else {
+            std::cerr << "Error decoding frame." << ret << std::endl;
+            METRICS_COUNT(touch ? Counter::CorruptionErrors : Counter::DecodeErrors, 1);
+            // Touched packets are expected to be rejected, keep going. The
+            // decoder may hold more frames, ask for them before feeding it.
+            if (touch == false)
+                return ret;
+            METRICS_COUNT(Counter::RejectedDecodeNs, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - receiving).count());
+            track_failures(0, 1);
+            if (++errors_in_row < max_errors_in_row)
+                continue;
+            skip_gop();
+            errors_in_row = 0;
+        }
+        if (flushing) {
+            // Only the frames drained by a skip may be left.
+            if (drained.empty())
+                return -1;
+            continue;
+        }
+
+        // A packet the decoder had no room for goes again, now that its
+        // frames are out.
+        if (!pending) {
+            // Fetch a frame
+            {
+                METRICS_TIME(Stage::Demux);
+                ret = av_read_frame(ctx_format, packet);
+            }
 
-    // Is this a video stream?
-    if (ret >= 0 and packet->stream_index != stream_index) {
+            // End of the stream, drain the frames still inside the decoder.
+            if (ret < 0) {
+                flushing = true;
+                ret = avcodec_send_packet(ctx_decode, NULL);
+                if (ret < 0 and ret != AVERROR_EOF) {
+                    std::cerr << "Error flushing the decoder: " << ret << std::endl;
+                    return ret;
+                }
+                continue;
+            }
+
+            // Is this a video stream?
+            if (packet->stream_index != stream_index) {
+                av_packet_unref(packet);
+                continue;
+            }
+
+            // The rest of a damaged GOP is never decoded.
+            if (skipping and !(packet->flags & AV_PKT_FLAG_KEY)) {
+                METRICS_COUNT(Counter::SkippedPackets, 1);
+                av_packet_unref(packet);
+                continue;
+            }
+            skipping = false;
+
+            // The corruption adapts within a GOP only, so the intensity of a
+            // packet does not depend on where a chunk or a resumed run starts.
+            if (packet->flags & AV_PKT_FLAG_KEY and errors.max_failure_rate > 0) {
+                window_packets = window_failures = 0;
+                intensity = 1;
+                corruption.set_intensity(intensity);
+            }
+
+            // Should the packet be touched? Not if no selected frame can see it.
+            if (touch and reaches_selection())
+                this->random_touch();
+        }
+
+        // Try sending the packet.
+        auto sending = Clock::now();
+        {
+            METRICS_TIME(Stage::SendPacket);
+            ret = avcodec_send_packet(ctx_decode, packet);
+        }
+        pending = ret == AVERROR(EAGAIN);
+        if (pending)
+            continue;
+        METRICS_COUNT(Counter::Packets, 1);
         av_packet_unref(packet);
+        if (ret < 0) {
+            METRICS_COUNT(touch ? Counter::CorruptionErrors : Counter::DecodeErrors, 1);
+            METRICS_COUNT(Counter::RejectedDecodeNs, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sending).count());
+        }
+        if (ret < 0 and touch == false) {
+            std::cerr << "Error submitting a packet for decoding: " << ret << std::endl;
+            return ret;
+        }
+        if (touch)
+            track_failures(1, ret < 0);
+        if (ret == 0)
+            errors_in_row = 0;
+
+        // Out of time for this frame, the budget starts over at the next
+        // keyframe.
+        if (budgeted and !skipping and Clock::now() - started > budget) {
+            METRICS_COUNT(Counter::SlowFrames, 1);
+            skip_gop();
+            started = Clock::now();
+        }
+    }
+
+    METRICS_COUNT(Counter::Frames, 1);
+    frame_count++;
+    frame_pts = frame_out->best_effort_timestamp;
+    if (frame_pts == AV_NOPTS_VALUE)
+        frame_pts = frame_out->pts;
+
+    // Software frames are already in system memory.
+    downloaded = !hw_acc_enabled;
+    return 0;
+}
+
+int VideoDecoder::download()
+{
+    if (downloaded)
+        return 0;
+
+    // Retrieve data from GPU to CPU. Frames handed out earlier may still
+    // share the old buffers, so always download into new ones.
+    av_frame_unref(frame);
+    METRICS_TIME(Stage::Transfer);
+    int ret = av_hwframe_transfer_data(frame, frame_hw, 0);
+    if (ret < 0) {
+        std::cerr << "Cannot transfer HW data to system memory." << std::endl;
         return ret;
     }
+    downloaded = true;
+    return 0;
+}
 
-    // Should the packet be touched?
-    if (touch)
-        this->random_touch();
+int VideoDecoder::retrieve()
+{
+    if (converted)
+        return 0;
+    int ret = download();
+    if (ret < 0)
+        return ret;
 
-    // Try sending the packet.
+    // Convert
+    ret = to_bgr();
+    converted = ret == 0;
+    return ret;
+}
+
+int VideoDecoder::retrieve(FramePtr& out)
+{
+    int ret = download();
     if (ret < 0)
-        ret = avcodec_send_packet(ctx_decode, NULL);
-    else {
-        ret = avcodec_send_packet(ctx_decode, packet);
+        return ret;
+    out.reset(av_frame_clone(frame));
+    if (!out) {
+        std::cerr << "Cannot allocate frame." << std::endl;
+        return AVERROR(ENOMEM);
     }
-    av_packet_unref(packet);
-    if (ret < 0 and touch == false) {
-        std::cerr << "Error submitting a packet for decoding: " << ret << std::endl;
+    return 0;
+}
+
+int VideoDecoder::retrieve_bgr(FramePtr& out)
+{
+    int ret = retrieve();
+    if (ret < 0)
         return ret;
+    out.reset(av_frame_clone(frame_bgr));
+    if (!out) {
+        std::cerr << "Cannot allocate frame." << std::endl;
+        return AVERROR(ENOMEM);
     }
+    return 0;
+}
 
-    // Frame got?
-    if (hw_acc_enabled)
-        ret = avcodec_receive_frame(ctx_decode, frame_hw);
-    else
-        ret = avcodec_receive_frame(ctx_decode, frame);
-    if (ret == AVERROR_EOF)
-        return -1;
-    else if (ret == AVERROR(EAGAIN)) {
+int VideoDecoder::read(bool touch)
+{
+    int ret = grab(touch);
+    if (ret < 0)
+        return ret;
+    return retrieve();
+}
+
+int VideoDecoder::read(FramePtr& out, bool touch)
+{
+    int ret = grab(touch);
+    if (ret < 0)
         return ret;
-    } else if (ret < 0) {
-        std::cerr << "Error decoding frame." << ret << std::endl;
+    return retrieve(out);
+}
+
+int VideoDecoder::read_bgr(FramePtr& out, bool touch)
+{
+    int ret = grab(touch);
+    if (ret < 0)
         return ret;
+    return retrieve_bgr(out);
+}
+
+int64_t VideoDecoder::get_frame_pts()
+{
+    return frame_pts;
+}
+
+VideoIndex VideoDecoder::build_index()
+{
+    VideoIndex index;
+    while (av_read_frame(ctx_format, packet) >= 0) {
+        if (packet->stream_index == stream_index) {
+            int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (pts != AV_NOPTS_VALUE) {
+                index.frames.push_back(pts);
+                if (packet->flags & AV_PKT_FLAG_KEY)
+                    index.keyframes.push_back(pts);
+            }
+        }
+        av_packet_unref(packet);
     }
+    std::sort(index.frames.begin(), index.frames.end());
+    std::sort(index.keyframes.begin(), index.keyframes.end());
+    index.width = ctx_decode->width;
+    index.height = ctx_decode->height;
+    return index;
+}
 
-    // Retrieve data from GPU to CPU if necessary
-    if (hw_acc_enabled) {
-        ret = av_hwframe_transfer_data(frame, frame_hw, 0);
-        if (ret < 0) {
-            std::cerr << "Cannot transfer HW data to system memory." << std::endl;
+std::pair<int, int> probe_frame_dims(const std::string& url)
+{
+    if (url == "-")
+        return { 0, 0 };
+    AVFormatContext* format = nullptr;
+    if (avformat_open_input(&format, url.c_str(), nullptr, nullptr) < 0)
+        return { 0, 0 };
+
+    // Most containers have the size in their header, the others need a
+    // look at the first packets.
+    int index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if ((index < 0 or format->streams[index]->codecpar->width <= 0) and avformat_find_stream_info(format, nullptr) >= 0)
+        index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    std::pair<int, int> dims { 0, 0 };
+    if (index >= 0)
+        dims = { format->streams[index]->codecpar->width, format->streams[index]->codecpar->height };
+    avformat_close_input(&format);
+    return dims;
+}
+
+int VideoDecoder::seek(int64_t pts)
+{
+    int ret = avformat_seek_file(ctx_format, stream_index, INT64_MIN, pts, pts, 0);
+    if (ret < 0) {
+        std::cerr << "Cannot seek to: " << pts << std::endl;
+        return ret;
+    }
+    avcodec_flush_buffers(ctx_decode);
+    av_packet_unref(packet);
+    drained.clear();
+    pending = false;
+    flushing = false;
+    skipping = false;
+    frame_pts = AV_NOPTS_VALUE;
+    frame_count = 0;
+    return 0;
+}
+
+void VideoDecoder::skip_gop()
+{
+    // Frames the decoder holds, or is still decoding on other threads, may
+    // be clean and even selected. Drain every one of them before the flush
+    // drops them. While the decoder still holds input, like when a packet is
+    // pending, it takes the end of stream only once frames are taken out.
+    bool draining = false, stalled = false;
+    while (true) {
+        if (!draining) {
+            int ret = avcodec_send_packet(ctx_decode, nullptr);
+            if (ret == 0 or ret == AVERROR_EOF)
+                draining = true;
+            else if (ret != AVERROR(EAGAIN))
+                break;
+        }
+        FramePtr decoded { av_frame_alloc() };
+        if (!decoded)
+            break;
+        int ret = avcodec_receive_frame(ctx_decode, decoded.get());
+        // Taking the held input may give no frame yet, then the end of
+        // stream goes in. A decoder taking neither twice has nothing left.
+        if (ret == AVERROR(EAGAIN) and !draining and !stalled) {
+            stalled = true;
+            continue;
+        }
+        if (ret == AVERROR_EOF or ret == AVERROR(EAGAIN))
+            break;
+        stalled = false;
+        if (ret == 0)
+            drained.push_back(std::move(decoded));
+        else
+            METRICS_COUNT(Counter::CorruptionErrors, 1);
+    }
+    avcodec_flush_buffers(ctx_decode);
+
+    // A keyframe waiting to be sent starts the next GOP, it is kept.
+    bool keyframe = pending and packet->flags & AV_PKT_FLAG_KEY;
+    if (pending and !keyframe)
+        av_packet_unref(packet);
+    pending = keyframe;
+    skipping = !keyframe;
+}
+
+void VideoDecoder::track_failures(int packets, int failures)
+{
+    window_packets += packets;
+    window_failures += failures;
+    const int window = 32;
+    if (window_packets < window)
+        return;
+    double rate = (double)window_failures / window_packets;
+    window_packets = window_failures = 0;
+    if (errors.max_failure_rate <= 0)
+        return;
+
+    // Halve the corruption while too much is rejected, and double it again
+    // once well under the target.
+    if (rate > errors.max_failure_rate) {
+        if (errors.action == FailureAction::SkipGop) {
+            skip_gop();
+        } else if (intensity > 1.0 / 64) {
+            intensity /= 2;
+            corruption.set_intensity(intensity);
+            METRICS_COUNT(Counter::CorruptionBackoffs, 1);
+        }
+    } else if (rate < errors.max_failure_rate / 2 and intensity < 1) {
+        intensity = std::min(1.0, intensity * 2);
+        corruption.set_intensity(intensity);
+    }
+}
+
+bool FrameSelection::is_sparse() const
+{
+    return start > 0 or end >= 0 or !frames.empty() or every > 1 or rate > 0;
+}
+
+FrameSelection FrameSelection::every_nth(int n)
+{
+    FrameSelection selection;
+    selection.every = n;
+    return selection;
+}
+
+int64_t VideoDecoder::seconds_to_pts(double seconds)
+{
+    int64_t offset = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    return offset + av_rescale_q(std::llround(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+}
+
+// The frame list, the every n-th sampling and the rate sampling, in that
+// order. A frame picked by the rate sampling moves it to the next slot.
+bool VideoDecoder::is_sampled(int64_t pts, int frame_number)
+{
+    if (!selection.frames.empty() and !std::binary_search(selection.frames.begin(), selection.frames.end(), frame_number))
+        return false;
+    if (selection.every > 1 and frame_number % selection.every != 0)
+        return false;
+    if (selection.rate > 0 and pts != AV_NOPTS_VALUE) {
+        int64_t offset = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        int64_t slot = (int64_t)std::floor((pts - offset) * av_q2d(stream->time_base) * selection.rate);
+        if (slot <= last_slot)
+            return false;
+        last_slot = slot;
+    }
+    return true;
+}
+
+// A packet can only damage the frames decoded after it that reference its
+// GOP: the frames of the same GOP, and the leading frames of the next one.
+// By timestamp those all lie between the keyframe before its GOP and the
+// keyframe after it, and none of them is shown before the packet is decoded.
+bool VideoDecoder::reaches_selection()
+{
+    if (!selecting)
+        return true;
+    int64_t dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    if (dts == AV_NOPTS_VALUE)
+        return true;
+    if (!index)
+        return dts < range_end;
+    int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : dts;
+    const std::vector<int64_t>& keyframes = index->keyframes;
+    auto next_gop = std::upper_bound(keyframes.begin(), keyframes.end(), pts);
+    int64_t from = next_gop - keyframes.begin() >= 2 ? *(next_gop - 2) : INT64_MIN;
+    int64_t to = next_gop != keyframes.end() ? *next_gop : INT64_MAX;
+    auto target = std::lower_bound(targets.begin(), targets.end(), std::max(from, dts));
+    return target != targets.end() and *target < to;
+}
+
+int VideoDecoder::select(const FrameSelection& selection, const VideoIndex* index, int64_t start, int64_t end)
+{
+    this->selection = selection;
+    std::sort(this->selection.frames.begin(), this->selection.frames.end());
+    this->index = index;
+    selecting = true;
+    targets.clear();
+    next_target = 0;
+    sought = INT64_MIN;
+    last_slot = INT64_MIN;
+    range_start = selection.start > 0 ? std::max(start, seconds_to_pts(selection.start)) : start;
+    range_end = selection.end >= 0 ? std::min(end, seconds_to_pts(selection.end)) : end;
+
+    // Without an index, decode from the start of the range and filter. Pipes
+    // cannot seek, they are filtered from the first frame.
+    if (!index) {
+        if (!selection.frames.empty()) {
+            std::cerr << "Selecting frames by number needs an index." << std::endl;
+            return -1;
+        }
+        if (range_start != INT64_MIN)
+            seek(range_start);
+        return 0;
+    }
+
+    for (size_t i = 0; i < index->frames.size(); i++) {
+        int64_t pts = index->frames[i];
+        if (pts >= range_start and pts < range_end and is_sampled(pts, (int)i + 1))
+            targets.push_back(pts);
+    }
+    last_slot = INT64_MIN;
+    if (targets.empty())
+        return 0;
+    int ret = seek(targets.front());
+    return ret < 0 ? ret : (int)targets.size();
+}
+
+int VideoDecoder::grab_selected(bool touch, const std::function<void()>& passed)
+{
+    while (true) {
+        // Jump over the GOPs without any selected frame, unless the next one
+        // has some: reading on is cheaper than seeking then.
+        if (index) {
+            if (next_target >= targets.size())
+                return -1;
+            if (frame_pts != AV_NOPTS_VALUE) {
+                const std::vector<int64_t>& keyframes = index->keyframes;
+                auto next_gop = std::upper_bound(keyframes.begin(), keyframes.end(), frame_pts);
+                auto target_gop = std::upper_bound(keyframes.begin(), keyframes.end(), targets[next_target]) - 1;
+                if (next_gop < target_gop and targets[next_target] != sought) {
+                    sought = targets[next_target]; // once, in case the demuxer lands early
+                    int ret = seek(sought);
+                    if (ret < 0)
+                        return ret;
+                }
+            }
+        }
+
+        int ret = grab(touch);
+        if (ret < 0)
             return ret;
+
+        // Frames come out in presentation order.
+        if (frame_pts != AV_NOPTS_VALUE and frame_pts < range_start)
+            continue;
+        if (frame_pts != AV_NOPTS_VALUE and frame_pts >= range_end)
+            return -1;
+        bool selected;
+        if (index) {
+            while (next_target < targets.size() and targets[next_target] < frame_pts)
+                next_target++;
+            selected = next_target < targets.size() and targets[next_target] == frame_pts;
+            if (selected)
+                next_target++;
+        } else {
+            selected = is_sampled(frame_pts, get_frame_number());
         }
+        if (selected)
+            return 0;
+        if (passed)
+            passed();
     }
+}
 
-    // Convert
-    ret = to_bgr();
+int VideoDecoder::get_frame_number()
+{
+    if (frame_pts == AV_NOPTS_VALUE)
+        return frame_count;
+    if (index)
+        return index->frame_number(frame_pts);
+    int64_t offset = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    return (int)std::llround((frame_pts - offset) * av_q2d(stream->time_base) * av_q2d(get_frame_rate())) + 1;
+}
 
-    return ret;
-}
\ No newline at end of file
+int VideoIndex::frame_number(int64_t pts) const
+{
+    return std::lower_bound(frames.begin(), frames.end(), pts) - frames.begin() + 1;
+}
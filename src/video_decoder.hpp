@@ -1,11 +1,19 @@
 #if !defined(VIDEO_DECODER_HPP)
 #define VIDEO_DECODER_HPP
 
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <random>
 #include <string>
+#include <thread>
 
 #include "config.h"
+#include "corruption_engine.hpp"
+#include "decoder_pool.hpp"
+#include "frame_converter.hpp"
+#include "frame_pool.hpp"
+#include "input_source.hpp"
 #include "opencv2/opencv.hpp"
 
 #ifdef WITH_GUI
@@ -20,13 +28,132 @@ extern "C" {
 #include "libswscale/swscale.h"
 }
 
+class RunLog;
+
+/// @brief Frames handed out by the decoder own a reference to the decoded data.
+struct FrameDeleter {
+    void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+};
+using FramePtr = std::unique_ptr<AVFrame, FrameDeleter>;
+
+/// @brief Keyframes and frame timestamps of the video stream, in the stream
+/// time base.
+struct VideoIndex {
+    std::vector<int64_t> keyframes; // sorted
+    std::vector<int64_t> frames; // sorted, one per video packet
+    int width = 0, height = 0; // of the decoded frames
+
+    /// @brief Get the frame number of a timestamp, counting from 1 in
+    /// presentation order.
+    int frame_number(int64_t pts) const;
+};
+
+/// @brief Which frames to decode. A frame is selected if it is inside the
+/// time range, in the frame list if there is one, and picked by both
+/// samplings.
+struct FrameSelection {
+    // Time range in seconds from the start of the stream, end < 0 for all of it.
+    double start = 0;
+    double end = -1;
+    // Frame numbers, counting from 1 in presentation order. Needs an index.
+    std::vector<int> frames; // sorted
+    // Every n-th frame by frame number.
+    int every = 1;
+    // Frames per second of video time, 0 for all.
+    double rate = 0;
+
+    /// @brief Check if only a part of the frames are selected.
+    bool is_sparse() const;
+
+    /// @brief Get a selection of every n-th frame.
+    static FrameSelection every_nth(int n);
+};
+
+/// @brief Threading model of the software decoder.
+enum class ThreadType {
+    Auto, // Frame and slice threading, whichever the codec supports
+    Frame, // One frame per thread, adds a few frames of latency
+    Slice, // Slices of one frame in parallel, no extra latency
+};
+
+/// @brief Decoding quality.
+enum class DecodeQuality {
+    Full, // every pixel as the encoder intended
+    Preview, // reduced resolution and skipped filters, for thumbnail sized output
+};
+
+/// @brief What to do while the decoder rejects too many packets.
+enum class FailureAction {
+    LowerCorruption, // touch fewer packets, and more again once it calms down or at the next keyframe
+    SkipGop, // drop the packets up to the next keyframe, keeping the frames already decoded
+};
+
+/// @brief How the decoder deals with corrupted packets.
+struct ErrorPolicy {
+    // AV_EF_* flags of the bitstream errors looked for, and FF_EC_* flags of
+    // how broken blocks are hidden, -1 for the defaults of FFmpeg. Fewer
+    // checks and no concealment let more of the damage show.
+    int recognition = -1;
+    int concealment = -1;
+
+    // Max seconds to get one frame out of touched packets, 0 for no limit.
+    // Past it, the rest of the GOP is skipped.
+    double frame_budget = 0;
+
+    // Max share of the touched packets the decoder may reject, 0 for any.
+    double max_failure_rate = 0;
+    FailureAction action = FailureAction::LowerCorruption;
+};
+
+/// @brief Options for creating the decoder.
+struct DecoderOptions {
+    // Number of decoding threads, 0 for all cores.
+    int threads = 0;
+    ThreadType thread_type = ThreadType::Auto;
+
+    // Size and crop of the BGR frame, the full frame by default.
+    OutputGeometry output;
+
+    // Preview quality picks its shortcuts from the output size.
+    DecodeQuality quality = DecodeQuality::Full;
+
+    // Seed and strategy of random_touch().
+    CorruptionOptions corruption;
+
+    // Handling of the errors the corruption causes.
+    ErrorPolicy errors;
+
+    // Max number of BGR frames out at once, see read_bgr().
+    int pool_capacity = 8;
+
+    // How local files are read.
+    IoMode io = IoMode::Mmap;
+
+    // If given, the opened contexts are taken from it and given back, for
+    // runs over many videos with the same codec parameters.
+    DecoderPool* contexts = nullptr;
+
+    // If given, every corruption is logged to it, and packets touched by an
+    // earlier run are touched the same way again.
+    RunLog* log = nullptr;
+
+    // Probe only a few KB, and skip probing the packets for containers
+    // whose header describes the streams, like MP4 and Matroska.
+    bool fast_open = false;
+};
+
 /// @brief A simple wrapper for video decoding.
 class VideoDecoder {
 private:
     // Contexts
+    std::unique_ptr<InputSource> input; // custom I/O, if any
     AVFormatContext* ctx_format = nullptr;
     AVCodecContext* ctx_decode = nullptr;
-    SwsContext* ctx_sws = nullptr;
+    DecoderPool* contexts = nullptr; // where ctx_decode goes back to
+    std::string contexts_key;
+    std::string make_contexts_key(const DecoderOptions& options);
+    int open_stream(const std::string& url, bool fast_open);
+    int open_decoder(const DecoderOptions& options);
 
     // Decoder
     AVCodec* decoder = nullptr;
@@ -35,11 +162,44 @@ private:
 
     // Packet
     AVPacket* packet = nullptr;
+    bool pending = false; // sent, but the decoder had no room for it
+    bool flushing = false;
+    CorruptionEngine corruption;
+    RunLog* log = nullptr;
+    CorruptionRecord record; // of the last touched packet
+    int64_t frame_pts = AV_NOPTS_VALUE;
+    int frame_count = 0; // since the last seek, for frames without timestamps
+
+    // Error resilience, see ErrorPolicy. The failure rate is taken over
+    // windows of touched packets.
+    ErrorPolicy errors;
+    bool skipping = false; // dropping packets up to the next keyframe
+    std::deque<FramePtr> drained; // decoded before a skip, handed out first
+    int window_packets = 0;
+    int window_failures = 0;
+    double intensity = 1; // of the corruption
+    void skip_gop();
+    void track_failures(int packets, int failures);
+
+    // Frame selection. With an index, the timestamps of the selected frames
+    // are known up front, and whole GOPs without any are skipped.
+    FrameSelection selection;
+    const VideoIndex* index = nullptr;
+    std::vector<int64_t> targets; // sorted
+    size_t next_target = 0;
+    int64_t sought = INT64_MIN; // target of the last jump
+    int64_t range_start = INT64_MIN, range_end = INT64_MAX; // in the stream time base
+    int64_t last_slot = INT64_MIN; // of the rate sampling
+    bool selecting = false;
+    int64_t seconds_to_pts(double seconds);
+    bool is_sampled(int64_t pts, int frame_number);
+    bool reaches_selection();
 
     // Frames
     AVFrame* frame = nullptr; // in system memory
     AVFrame* frame_hw = nullptr; // in hardware memory
     AVFrame* frame_bgr = nullptr; // in system memory, BGR format
+    FramePool pool; // buffers of frame_bgr
 
     // Hardware accelerations
     std::vector<AVHWDeviceType> hw_accelerators;
@@ -49,16 +209,28 @@ private:
     void query_supported_hw_devices(std::vector<AVHWDeviceType>& hw_accelerators);
     static AVPixelFormat get_hw_format(AVCodecContext* ctx, const AVPixelFormat* pix_fmts);
 
+    // Preview quality decoding
+    void set_preview_quality(const OutputGeometry& output);
+
     // Format convert
     AVPixelFormat output_fmt = AV_PIX_FMT_BGR24;
+    FrameConverter converter;
     int to_bgr();
 
+    // Lazy conversion: grab() only decodes, the download from the GPU and the
+    // color conversion run when the pixels are asked for.
+    bool downloaded = false;
+    bool converted = false;
+    int download();
+
     // Some flags
     bool initialized = false;
     bool hw_acc_enabled = false;
 
 public:
-    VideoDecoder(const std::string url, AVHWDeviceType hw_acc = AV_HWDEVICE_TYPE_NONE);
+    /// @brief Open a video.
+    /// @param url a file or anything FFmpeg can open, `-` for stdin.
+    VideoDecoder(const std::string url, AVHWDeviceType hw_acc = AV_HWDEVICE_TYPE_NONE, DecoderOptions options = {});
     ~VideoDecoder();
 
     /// @brief check if the decoder was successfully initialized.
@@ -69,28 +241,125 @@ public:
     /// @return true if accelerated, else false.
     bool is_accelerated();
 
-    /// @brief Get the frame size.
+    /// @brief Get the size of the BGR frame, after scaling and cropping.
     /// @return a std::pair of <width, height>
     std::pair<int, int> get_frame_dims();
 
+    /// @brief Get the size of the decoded frames, before any conversion.
+    /// @return a std::pair of <width, height>
+    std::pair<int, int> get_source_dims();
+
+    /// @brief Get the I/O counters of the input.
+    /// @return the counters, all 0 if FFmpeg reads the input itself.
+    InputStats get_io_stats();
+
+    /// @brief Get the average frame rate of the video stream.
+    /// @return the frame rate, 25 if unknown.
+    AVRational get_frame_rate();
+
     /// @brief Get the frame's step size. This is used for constructing OpenCV Mat.
     /// @return the step.
     int get_frame_steps();
 
-    /// @brief Touch the decoding packet data, randomly.
+    /// @brief Touch the decoding packet data, randomly. The result is
+    /// reproducible with the same corruption seed.
     void random_touch();
 
     /// @brief List available hardware accelerators.
     /// @return a vector of accelerator names.
     std::vector<std::string> list_hw_accelerators();
 
-    /// @brief  Get the BGR frame buffer.
+    /// @brief  Get the BGR frame buffer. It is overwritten by the next
+    /// retrieve(), use retrieve_bgr() to keep a frame.
     /// @return the pointer of pixel data.
     uint8_t* get_buffer();
 
-    /// @brief Read a frame to buf.
+    /// @brief Decode the next frame and keep it in its native format, without
+    /// any conversion. Call retrieve() if the pixels are needed.
+    /// @param touch if true, the packet data will be touched randomly.
+    /// @return 0 if success, -1 at the end of the stream, other negative for errors.
+    int grab(bool touch = false);
+
+    /// @brief Convert the grabbed frame into the BGR buffer.
+    /// @return 0 if success, else negative.
+    int retrieve();
+
+    /// @brief Get the grabbed frame in system memory, without converting it.
+    /// The frame shares its data with the decoder and stays valid after the
+    /// next grab.
+    /// @param out the decoded frame, usually YUV.
+    /// @return 0 if success, else negative.
+    int retrieve(FramePtr& out);
+
+    /// @brief Convert the grabbed frame into a new BGR frame from the pool.
+    /// The frame is ref-counted and never overwritten by the decoder, wrap
+    /// it with frame_to_mat() and release it whenever done. Holding on to
+    /// more than pool_capacity - 1 frames makes this wait.
+    /// @param out the BGR frame, scaled and cropped.
+    /// @return 0 if success, else negative.
+    int retrieve_bgr(FramePtr& out);
+
+    /// @brief Get the presentation timestamp of the grabbed frame.
+    /// @return the timestamp in the stream time base, or AV_NOPTS_VALUE.
+    int64_t get_frame_pts();
+
+    /// @brief Scan the packets of the video stream without decoding them.
+    /// The stream is read to the end, seek() before grabbing any frame.
+    /// @return the index of the stream.
+    VideoIndex build_index();
+
+    /// @brief Select the frames grab_selected() stops at, and seek to the
+    /// first GOP holding any of them.
+    /// @param selection the frames wanted.
+    /// @param index the index of the stream, needed by frame lists. It must
+    /// outlive the selection.
+    /// @param start the first timestamp of a chunk, in the stream time base.
+    /// @param end the timestamp after the chunk.
+    /// @return number of selected frames if known, 0 if not, negative for errors.
+    int select(const FrameSelection& selection, const VideoIndex* index = nullptr, int64_t start = INT64_MIN, int64_t end = INT64_MAX);
+
+    /// @brief Decode until the next selected frame. GOPs without any are
+    /// skipped, and only packets whose errors can reach a selected frame are
+    /// touched.
+    /// @param touch if true, the packet data will be touched randomly.
+    /// @param passed if given, called for every frame of the range decoded
+    /// on the way but not selected, while it is the grabbed frame.
+    /// @return 0 if success, -1 when no more frames are selected, other negative for errors.
+    int grab_selected(bool touch = false, const std::function<void()>& passed = nullptr);
+
+    /// @brief Get the frame number of the grabbed frame, counting from 1 in
+    /// presentation order. Taken from the index if any, else from the
+    /// timestamp and the frame rate.
+    int get_frame_number();
+
+    /// @brief Seek to the keyframe at or before the timestamp, and drop
+    /// everything buffered in the decoder.
+    /// @param pts the timestamp in the stream time base.
+    /// @return 0 if success, else negative.
+    int seek(int64_t pts);
+
+    /// @brief Read a frame to buf. Packets are fed to the decoder until a frame
+    /// comes out, so the latency of frame threading is hidden from the caller.
     /// @param touch if true, the packet data will be touched randomly.
-    /// @return 0 if success, -11 if try again is required, other negative for errors.
+    /// @return 0 if success, -1 at the end of the stream, other negative for errors.
     int read(bool touch = false);
+
+    /// @brief Read a decoded frame without converting it. The frame shares its
+    /// data with the decoder and stays valid after the next read.
+    /// @param out the decoded frame in system memory, usually YUV.
+    /// @param touch if true, the packet data will be touched randomly.
+    /// @return 0 if success, -1 at the end of the stream, other negative for errors.
+    int read(FramePtr& out, bool touch = false);
+
+    /// @brief Read a frame and convert it into a new BGR frame from the pool.
+    /// @param out the BGR frame, see retrieve_bgr().
+    /// @param touch if true, the packet data will be touched randomly.
+    /// @return 0 if success, -1 at the end of the stream, other negative for errors.
+    int read_bgr(FramePtr& out, bool touch = false);
 };
+
+/// @brief Get the size of the video stream from the container alone, without
+/// opening any decoder. Pipes are not probed, they can only be read once.
+/// @return a std::pair of <width, height>, 0 if unknown.
+std::pair<int, int> probe_frame_dims(const std::string& url);
 #endif // VIDEO_DECODER_HPP
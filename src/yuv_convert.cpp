@@ -0,0 +1,104 @@
+#include "config.h"
+#include "yuv_convert_kernel.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+void yuv_rows_scalar(YuvRowTable& table)
+{
+    table.rows[(int)YuvLayout::Yuv420p][(int)BgrLayout::Bgr24] = scalar_row<YuvLayout::Yuv420p, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Yuv420p][(int)BgrLayout::Bgra] = scalar_row<YuvLayout::Yuv420p, BgrLayout::Bgra>;
+    table.rows[(int)YuvLayout::Nv12][(int)BgrLayout::Bgr24] = scalar_row<YuvLayout::Nv12, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Nv12][(int)BgrLayout::Bgra] = scalar_row<YuvLayout::Nv12, BgrLayout::Bgra>;
+    table.rows[(int)YuvLayout::Yuv420p10][(int)BgrLayout::Bgr24] = scalar_row<YuvLayout::Yuv420p10, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Yuv420p10][(int)BgrLayout::Bgra] = scalar_row<YuvLayout::Yuv420p10, BgrLayout::Bgra>;
+}
+
+SimdLevel simd_level()
+{
+#if defined(HAVE_X86_SIMD)
+    static SimdLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512bw"))
+            return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse4.1"))
+            return SimdLevel::SSE41;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* simd_name(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::SSE41:
+        return "sse4.1";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+static const YuvRowTable& row_table(SimdLevel level)
+{
+    static const std::vector<YuvRowTable> tables = [] {
+        std::vector<YuvRowTable> tables(4);
+        yuv_rows_scalar(tables[(int)SimdLevel::Scalar]);
+#if defined(HAVE_X86_SIMD)
+        yuv_rows_sse41(tables[(int)SimdLevel::SSE41]);
+        yuv_rows_avx2(tables[(int)SimdLevel::AVX2]);
+        yuv_rows_avx512(tables[(int)SimdLevel::AVX512]);
+#else
+        for (int i = 1; i < 4; i++)
+            tables[i] = tables[0];
+#endif
+        return tables;
+    }();
+    return tables[(int)std::min(level, simd_level())];
+}
+
+// BT.601, the matrix swscale assumes by default.
+static YuvCoefficients coefficients(YuvLayout layout, bool full_range)
+{
+    int depth_shift = layout == YuvLayout::Yuv420p10 ? 2 : 0;
+    if (full_range)
+        return { 0, 128 << depth_shift, 256, 359, 88, 183, 454 };
+    return { 16 << depth_shift, 128 << depth_shift, 298, 409, 100, 208, 516 };
+}
+
+void yuv_to_bgr(const YuvImage& src, uint8_t* dst, int dst_step, BgrLayout layout, int threads, SimdLevel level)
+{
+    YuvRowFunc row = row_table(level).rows[(int)src.layout][(int)layout];
+    YuvCoefficients k = coefficients(src.layout, src.full_range);
+    auto convert_rows = [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const uint8_t* luma = src.data[0] + (ptrdiff_t)y * src.linesize[0];
+            const uint8_t* u = src.data[1] + (ptrdiff_t)(y / 2) * src.linesize[1];
+            const uint8_t* v = src.layout == YuvLayout::Nv12 ? nullptr : src.data[2] + (ptrdiff_t)(y / 2) * src.linesize[2];
+            row(luma, u, v, dst + (ptrdiff_t)y * dst_step, src.width, k);
+        }
+    };
+
+    // Bands of whole chroma rows, the calling thread takes the first one.
+    threads = std::clamp(threads, 1, std::max(1, src.height / 16));
+    if (threads == 1) {
+        convert_rows(0, src.height);
+        return;
+    }
+    int band = (src.height / threads + 1) & ~1;
+    std::vector<std::thread> workers;
+    for (int begin = band; begin < src.height; begin += band)
+        workers.emplace_back(convert_rows, begin, std::min(src.height, begin + band));
+    convert_rows(0, std::min(src.height, band));
+    for (auto& worker : workers)
+        worker.join();
+}
@@ -0,0 +1,55 @@
+#if !defined(YUV_CONVERT_HPP)
+#define YUV_CONVERT_HPP
+
+#include <cstdint>
+
+/// @brief Instruction sets of the conversion kernels.
+enum class SimdLevel {
+    Scalar,
+    SSE41,
+    AVX2,
+    AVX512,
+};
+
+/// @brief Source layouts with a dedicated kernel, all 4:2:0.
+enum class YuvLayout {
+    Yuv420p, // three 8 bit planes
+    Nv12, // 8 bit luma plane, interleaved chroma plane
+    Yuv420p10, // three 16 bit little endian planes, 10 bits used
+    Count
+};
+
+/// @brief Packed output layouts.
+enum class BgrLayout {
+    Bgr24,
+    Bgra,
+    Count
+};
+
+/// @brief A decoded picture, or a window of it. Chroma rows and columns
+/// are at half the luma resolution. For Nv12, data[1] is the chroma plane.
+struct YuvImage {
+    const uint8_t* data[3];
+    int linesize[3];
+    YuvLayout layout;
+    int width;
+    int height;
+    bool full_range; // JPEG range instead of the 16-235 video range
+};
+
+/// @brief Get the best instruction set of this CPU.
+SimdLevel simd_level();
+
+/// @brief Get the name of an instruction set, like "avx2".
+const char* simd_name(SimdLevel level);
+
+/// @brief Convert YUV to BGR with the BT.601 matrix in fixed point, the
+/// same integer math on every instruction set.
+/// @param src the source picture.
+/// @param dst the first row of the output.
+/// @param dst_step the row size of the output in bytes.
+/// @param threads number of threads converting bands of rows, 1 to stay on
+/// the calling thread.
+/// @param level the kernels to use, clamped to what the CPU supports.
+void yuv_to_bgr(const YuvImage& src, uint8_t* dst, int dst_step, BgrLayout layout, int threads = 1, SimdLevel level = simd_level());
+#endif // YUV_CONVERT_HPP
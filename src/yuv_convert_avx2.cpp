@@ -0,0 +1,72 @@
+#include "config.h"
+#include "yuv_convert_kernel.hpp"
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2 {
+    using V = __m256i;
+    static const int lanes = 8;
+
+    static V set1(int value) { return _mm256_set1_epi32(value); }
+    static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+    static V mul(V a, V b) { return _mm256_mullo_epi32(a, b); }
+    template <int n>
+    static V sra(V a) { return _mm256_srai_epi32(a, n); }
+
+    static V load8(const uint8_t* p)
+    {
+        return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+    }
+    // Every chroma sample twice, for two luma columns.
+    static V load_chroma8(const uint8_t* p)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, p, 4);
+        __m128i x = _mm_cvtsi32_si128(bytes);
+        return _mm256_cvtepu8_epi32(_mm_unpacklo_epi8(x, x));
+    }
+    static void load_nv8(const uint8_t* p, V& u, V& v)
+    {
+        V uv = load8(p);
+        u = _mm256_shuffle_epi32(uv, 0xA0);
+        v = _mm256_shuffle_epi32(uv, 0xF5);
+    }
+    static V load16(const uint8_t* p)
+    {
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+    }
+    static V load_chroma16(const uint8_t* p)
+    {
+        __m128i x = _mm_loadl_epi64((const __m128i*)p);
+        return _mm256_cvtepu16_epi32(_mm_unpacklo_epi16(x, x));
+    }
+
+    template <BgrLayout Dst>
+    static void store(uint8_t* dst, V b, V g, V r)
+    {
+        // Per 128 bit half: saturate to bytes, B G R A by 4, then interleave.
+        __m256i planar = _mm256_packus_epi16(_mm256_packs_epi32(b, g), _mm256_packs_epi32(r, _mm256_set1_epi32(255)));
+        if constexpr (Dst == BgrLayout::Bgra) {
+            __m256i mask = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            _mm256_storeu_si256((__m256i*)dst, _mm256_shuffle_epi8(planar, mask));
+        } else {
+            __m256i mask = _mm256_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1,
+                0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+            __m256i packed = _mm256_shuffle_epi8(planar, mask);
+            __m128i low = _mm256_castsi256_si128(packed), high = _mm256_extracti128_si256(packed, 1);
+            std::memcpy(dst, &low, 12);
+            std::memcpy(dst + 12, &high, 12);
+        }
+    }
+};
+
+} // namespace
+
+void yuv_rows_avx2(YuvRowTable& table)
+{
+    fill_rows<Avx2>(table);
+}
@@ -0,0 +1,69 @@
+#include "config.h"
+#include "yuv_convert_kernel.hpp"
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx512 {
+    using V = __m512i;
+    static const int lanes = 16;
+
+    static V set1(int value) { return _mm512_set1_epi32(value); }
+    static V add(V a, V b) { return _mm512_add_epi32(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_epi32(a, b); }
+    static V mul(V a, V b) { return _mm512_mullo_epi32(a, b); }
+    template <int n>
+    static V sra(V a) { return _mm512_srai_epi32(a, n); }
+
+    static V load8(const uint8_t* p)
+    {
+        return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p));
+    }
+    // Every chroma sample twice, for two luma columns.
+    static V load_chroma8(const uint8_t* p)
+    {
+        __m128i x = _mm_loadl_epi64((const __m128i*)p);
+        return _mm512_cvtepu8_epi32(_mm_unpacklo_epi8(x, x));
+    }
+    static void load_nv8(const uint8_t* p, V& u, V& v)
+    {
+        V uv = load8(p);
+        u = _mm512_shuffle_epi32(uv, (_MM_PERM_ENUM)0xA0);
+        v = _mm512_shuffle_epi32(uv, (_MM_PERM_ENUM)0xF5);
+    }
+    static V load16(const uint8_t* p)
+    {
+        return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p));
+    }
+    static V load_chroma16(const uint8_t* p)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        return _mm512_cvtepu16_epi32(_mm256_set_m128i(_mm_unpackhi_epi16(x, x), _mm_unpacklo_epi16(x, x)));
+    }
+
+    template <BgrLayout Dst>
+    static void store(uint8_t* dst, V b, V g, V r)
+    {
+        // Per 128 bit quarter: saturate to bytes, B G R A by 4, then interleave.
+        __m512i planar = _mm512_packus_epi16(_mm512_packs_epi32(b, g), _mm512_packs_epi32(r, _mm512_set1_epi32(255)));
+        if constexpr (Dst == BgrLayout::Bgra) {
+            __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+            _mm512_storeu_si512(dst, _mm512_shuffle_epi8(planar, mask));
+        } else {
+            __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1));
+            __m512i packed = _mm512_shuffle_epi8(planar, mask);
+            __m128i quarters[4] = { _mm512_extracti32x4_epi32(packed, 0), _mm512_extracti32x4_epi32(packed, 1),
+                _mm512_extracti32x4_epi32(packed, 2), _mm512_extracti32x4_epi32(packed, 3) };
+            for (int i = 0; i < 4; i++)
+                std::memcpy(dst + i * 12, &quarters[i], 12);
+        }
+    }
+};
+
+} // namespace
+
+void yuv_rows_avx512(YuvRowTable& table)
+{
+    fill_rows<Avx512>(table);
+}
@@ -0,0 +1,140 @@
+#if !defined(YUV_CONVERT_KERNEL_HPP)
+#define YUV_CONVERT_KERNEL_HPP
+
+// Row kernels shared by the yuv_convert*.cpp files. Every file includes this
+// with its own instruction set enabled, so everything here stays internal
+// to the including file.
+
+#include <cstddef>
+#include <cstring>
+
+#include "yuv_convert.hpp"
+
+/// @brief Fixed point BT.601 coefficients, scaled by 2^shift where shift is
+/// the bit depth of the source.
+struct YuvCoefficients {
+    int y_offset;
+    int uv_offset;
+    int y;
+    int rv; // V to red
+    int gu; // U to green, subtracted
+    int gv; // V to green, subtracted
+    int bu; // U to blue
+};
+
+using YuvRowFunc = void (*)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width, const YuvCoefficients& k);
+
+/// @brief Row kernels for every source and output layout.
+struct YuvRowTable {
+    YuvRowFunc rows[(int)YuvLayout::Count][(int)BgrLayout::Count];
+};
+
+void yuv_rows_scalar(YuvRowTable& table);
+#if defined(HAVE_X86_SIMD)
+void yuv_rows_sse41(YuvRowTable& table);
+void yuv_rows_avx2(YuvRowTable& table);
+void yuv_rows_avx512(YuvRowTable& table);
+#endif
+
+namespace {
+
+inline uint8_t clip_u8(int value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+}
+
+inline int load_u16(const uint8_t* p, int index)
+{
+    uint16_t value;
+    std::memcpy(&value, p + index * 2, 2);
+    return value;
+}
+
+/// The reference: one pixel at a time, in plain integers.
+template <YuvLayout Src, BgrLayout Dst>
+inline void convert_pixels(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int begin, int end, const YuvCoefficients& k)
+{
+    constexpr int shift = Src == YuvLayout::Yuv420p10 ? 10 : 8;
+    constexpr int round = 1 << (shift - 1);
+    constexpr int bpp = Dst == BgrLayout::Bgra ? 4 : 3;
+    for (int x = begin; x < end; x++) {
+        int Y, U, V;
+        if constexpr (Src == YuvLayout::Yuv420p) {
+            Y = y[x];
+            U = u[x / 2];
+            V = v[x / 2];
+        } else if constexpr (Src == YuvLayout::Nv12) {
+            Y = y[x];
+            U = u[x / 2 * 2];
+            V = u[x / 2 * 2 + 1];
+        } else {
+            Y = load_u16(y, x);
+            U = load_u16(u, x / 2);
+            V = load_u16(v, x / 2);
+        }
+        int c = (Y - k.y_offset) * k.y, d = U - k.uv_offset, e = V - k.uv_offset;
+        uint8_t* p = dst + x * bpp;
+        p[0] = clip_u8((c + k.bu * d + round) >> shift);
+        p[1] = clip_u8((c + round - k.gu * d - k.gv * e) >> shift);
+        p[2] = clip_u8((c + k.rv * e + round) >> shift);
+        if constexpr (Dst == BgrLayout::Bgra)
+            p[3] = 255;
+    }
+}
+
+template <YuvLayout Src, BgrLayout Dst>
+void scalar_row(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width, const YuvCoefficients& k)
+{
+    convert_pixels<Src, Dst>(y, u, v, dst, 0, width, k);
+}
+
+/// The vector kernel, S::lanes pixels at a time in 32 bit lanes, so the
+/// result is exactly the same as the reference. The pixels left at the
+/// end of the row go through the reference.
+template <class S, YuvLayout Src, BgrLayout Dst>
+void simd_row(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width, const YuvCoefficients& k)
+{
+    constexpr int shift = Src == YuvLayout::Yuv420p10 ? 10 : 8;
+    constexpr int bpp = Dst == BgrLayout::Bgra ? 4 : 3;
+    using V = typename S::V;
+    const V y_offset = S::set1(k.y_offset), uv_offset = S::set1(k.uv_offset), round = S::set1(1 << (shift - 1));
+    const V ky = S::set1(k.y), krv = S::set1(k.rv), kgu = S::set1(k.gu), kgv = S::set1(k.gv), kbu = S::set1(k.bu);
+
+    int x = 0;
+    for (; x + S::lanes <= width; x += S::lanes) {
+        V Y, U, V_;
+        if constexpr (Src == YuvLayout::Yuv420p) {
+            Y = S::load8(y + x);
+            U = S::load_chroma8(u + x / 2);
+            V_ = S::load_chroma8(v + x / 2);
+        } else if constexpr (Src == YuvLayout::Nv12) {
+            Y = S::load8(y + x);
+            S::load_nv8(u + x, U, V_);
+        } else {
+            Y = S::load16(y + x * 2);
+            U = S::load_chroma16(u + x);
+            V_ = S::load_chroma16(v + x);
+        }
+        V c = S::add(S::mul(S::sub(Y, y_offset), ky), round);
+        V d = S::sub(U, uv_offset), e = S::sub(V_, uv_offset);
+        V b = S::template sra<shift>(S::add(c, S::mul(d, kbu)));
+        V g = S::template sra<shift>(S::sub(S::sub(c, S::mul(d, kgu)), S::mul(e, kgv)));
+        V r = S::template sra<shift>(S::add(c, S::mul(e, krv)));
+        S::template store<Dst>(dst + x * bpp, b, g, r);
+    }
+    convert_pixels<Src, Dst>(y, u, v, dst, x, width, k);
+}
+
+template <class S>
+void fill_rows(YuvRowTable& table)
+{
+    table.rows[(int)YuvLayout::Yuv420p][(int)BgrLayout::Bgr24] = simd_row<S, YuvLayout::Yuv420p, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Yuv420p][(int)BgrLayout::Bgra] = simd_row<S, YuvLayout::Yuv420p, BgrLayout::Bgra>;
+    table.rows[(int)YuvLayout::Nv12][(int)BgrLayout::Bgr24] = simd_row<S, YuvLayout::Nv12, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Nv12][(int)BgrLayout::Bgra] = simd_row<S, YuvLayout::Nv12, BgrLayout::Bgra>;
+    table.rows[(int)YuvLayout::Yuv420p10][(int)BgrLayout::Bgr24] = simd_row<S, YuvLayout::Yuv420p10, BgrLayout::Bgr24>;
+    table.rows[(int)YuvLayout::Yuv420p10][(int)BgrLayout::Bgra] = simd_row<S, YuvLayout::Yuv420p10, BgrLayout::Bgra>;
+}
+
+} // namespace
+#endif // YUV_CONVERT_KERNEL_HPP
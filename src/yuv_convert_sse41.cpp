@@ -0,0 +1,72 @@
+#include "config.h"
+#include "yuv_convert_kernel.hpp"
+
+#include <smmintrin.h>
+
+namespace {
+
+struct Sse41 {
+    using V = __m128i;
+    static const int lanes = 4;
+
+    static V set1(int value) { return _mm_set1_epi32(value); }
+    static V add(V a, V b) { return _mm_add_epi32(a, b); }
+    static V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+    static V mul(V a, V b) { return _mm_mullo_epi32(a, b); }
+    template <int n>
+    static V sra(V a) { return _mm_srai_epi32(a, n); }
+
+    static V load8(const uint8_t* p)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, p, 4);
+        return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    }
+    // Every chroma sample twice, for two luma columns.
+    static V load_chroma8(const uint8_t* p)
+    {
+        uint16_t bytes;
+        std::memcpy(&bytes, p, 2);
+        __m128i x = _mm_cvtsi32_si128(bytes);
+        return _mm_cvtepu8_epi32(_mm_unpacklo_epi8(x, x));
+    }
+    static void load_nv8(const uint8_t* p, V& u, V& v)
+    {
+        V uv = load8(p);
+        u = _mm_shuffle_epi32(uv, 0xA0);
+        v = _mm_shuffle_epi32(uv, 0xF5);
+    }
+    static V load16(const uint8_t* p)
+    {
+        return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)p));
+    }
+    static V load_chroma16(const uint8_t* p)
+    {
+        int32_t bytes;
+        std::memcpy(&bytes, p, 4);
+        __m128i x = _mm_cvtsi32_si128(bytes);
+        return _mm_cvtepu16_epi32(_mm_unpacklo_epi16(x, x));
+    }
+
+    template <BgrLayout Dst>
+    static void store(uint8_t* dst, V b, V g, V r)
+    {
+        // Saturate to bytes, B0-3 G0-3 R0-3 A0-3, then interleave.
+        __m128i planar = _mm_packus_epi16(_mm_packs_epi32(b, g), _mm_packs_epi32(r, _mm_set1_epi32(255)));
+        if constexpr (Dst == BgrLayout::Bgra) {
+            __m128i mask = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(planar, mask));
+        } else {
+            __m128i mask = _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+            __m128i packed = _mm_shuffle_epi8(planar, mask);
+            std::memcpy(dst, &packed, 12);
+        }
+    }
+};
+
+} // namespace
+
+void yuv_rows_sse41(YuvRowTable& table)
+{
+    fill_rows<Sse41>(table);
+}